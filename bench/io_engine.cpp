@@ -0,0 +1,170 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/io_engine.hpp"
+#include "proc/process.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Benchmark of io_engine backends.
+//
+// Starts a number of processes, which echo back what they read from stdin,
+// pumps data through their pipes and waits for them to exit, once with
+// io_uring (if supported) and once with epoll.
+//
+// Build with the library sources, eg:
+//   g++ -O2 -std=c++17 -I<dir containing proc> bench/io_engine.cpp *.cpp -pthread
+//
+// Usage: io_engine [processes [MiB per process [chunk KiB]]]
+//
+namespace
+{
+
+////////////////////
+// child: echo exactly total bytes from stdin to stdout
+int echo(std::size_t total)
+{
+    char buffer[64 * 1024];
+    for(std::size_t done = 0; done < total; )
+    {
+        auto n = ::read(STDIN_FILENO, buffer, sizeof(buffer));
+        if(n <= 0) return 1;
+
+        for(ssize_t c = 0; c < n; )
+        {
+            auto w = ::write(STDOUT_FILENO, buffer + c, n - c);
+            if(w <= 0) return 1;
+            c += w;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+////////////////////
+struct pump
+{
+    pgm::process proc;
+    std::size_t sent = 0, received = 0;
+    std::string in;
+    bool exited = false;
+
+    pgm::io_engine::handler on_write, on_read;
+};
+
+struct outcome
+{
+    std::chrono::nanoseconds time { };
+    std::size_t loops = 0; // calls to run_once()
+    std::size_t errors = 0;
+};
+
+outcome run(bool uring, std::size_t count, std::size_t total, std::size_t chunk)
+{
+    pgm::io_engine engine(256, uring);
+    std::cout << (engine.uring() ? "io_uring" : "epoll   ") << std::flush;
+
+    std::vector<std::unique_ptr<pump>> pumps;
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        pumps.emplace_back(new pump());
+        pumps.back()->proc = pgm::process([=]{ return echo(total); });
+        pumps.back()->in.resize(chunk);
+    }
+    std::string out(chunk, 'x');
+
+    outcome o;
+    auto start = std::chrono::steady_clock::now();
+
+    for(auto& each : pumps)
+    {
+        auto p = each.get();
+        auto in = p->proc.fd(p->proc.cin), from = p->proc.fd(p->proc.cout);
+
+        // as the data is all the same, every write starts at out
+        p->on_write = [&, p, in](int r)
+        {
+            if(r <= 0) { ++o.errors; return; }
+
+            p->sent += r;
+            if(p->sent < total)
+                engine.write(in, out.data(), std::min(chunk, total - p->sent), p->on_write);
+        };
+
+        p->on_read = [&, p, from](int r)
+        {
+            if(r <= 0) { ++o.errors; return; }
+
+            p->received += r;
+            if(p->received < total)
+                engine.read(from, &p->in[0], p->in.size(), p->on_read);
+        };
+
+        engine.write(in, out.data(), std::min(chunk, total), p->on_write);
+        engine.read(from, &p->in[0], p->in.size(), p->on_read);
+        engine.wait_exit(p->proc, [p](int){ p->exited = true; });
+    }
+
+    while(engine.pending())
+    {
+        engine.run_once();
+        ++o.loops;
+    }
+    o.time = std::chrono::steady_clock::now() - start;
+
+    for(auto& p : pumps)
+    {
+        if(!p->exited || p->received != total) ++o.errors;
+        p->proc.join();
+    }
+    return o;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+    std::size_t count = argc > 1 ? std::atoi(argv[1]) : 16;
+    std::size_t total = (argc > 2 ? std::atoi(argv[2]) : 64) << 20;
+    std::size_t chunk = (argc > 3 ? std::atoi(argv[3]) : 64) << 10;
+    if(!count || !total || !chunk)
+    {
+        std::cerr << "Usage: " << argv[0] << " [processes [MiB per process [chunk KiB]]]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << count << " processes, " << (total >> 20) << " MiB each, "
+        << (chunk >> 10) << " KiB chunks" << std::endl;
+
+    auto failed = false;
+    for(auto uring : { true, false })
+    {
+        auto o = run(uring, count, total, chunk);
+
+        using namespace std::chrono;
+        auto sec = duration<double>(o.time).count();
+
+        std::cout << ": " << duration_cast<milliseconds>(o.time).count() << " ms, "
+            << (2.0 * count * total / (1 << 20) / sec) << " MiB/s, "
+            << o.loops << " loops";
+        if(o.errors) std::cout << ", " << o.errors << " errors";
+        std::cout << std::endl;
+
+        failed |= o.errors > 0;
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
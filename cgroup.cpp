@@ -0,0 +1,169 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "posix/error.hpp"
+#include "proc/cgroup.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+namespace cgroup
+{
+
+////////////////////////////////////////////////////////////////////////////////
+bool open(const std::string& path) noexcept
+{
+    if(::mkdir(path.data(), 0755) && errno != EEXIST) return false;
+    return ::access((path + "/cgroup.procs").data(), W_OK) == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool enable(const std::string& path, const std::string& controllers) noexcept
+{
+    try { write(path, "cgroup.subtree_control", controllers); return true; }
+    catch(...) { return false; }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void remove(const std::string& path) noexcept { ::rmdir(path.data()); }
+
+////////////////////////////////////////////////////////////////////////////////
+void write(const std::string& path, const char* file, const std::string& value)
+{
+    auto fd = ::open((path + '/' + file).data(), O_WRONLY | O_CLOEXEC);
+    if(fd == -1) throw posix::errno_error();
+
+    auto n = ::write(fd, value.data(), value.size());
+    posix::errno_error error;
+    ::close(fd);
+
+    if(n != static_cast<ssize_t>(value.size())) throw error;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::string read(const std::string& path, const char* file)
+{
+    auto fd = ::open((path + '/' + file).data(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1) throw posix::errno_error();
+
+    std::string value;
+    char buffer[4096];
+    for(;;)
+    {
+        auto n = ::read(fd, buffer, sizeof(buffer));
+        if(n == -1 && errno == EINTR) continue;
+        if(n == -1)
+        {
+            posix::errno_error error;
+            ::close(fd);
+            throw error;
+        }
+        if(n == 0) break;
+        value.append(buffer, n);
+    }
+
+    ::close(fd);
+    return value;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::uint64_t read_value(const std::string& path, const char* file)
+{
+    auto value = read(path, file);
+    // "max" means no limit
+    return value.compare(0, 3, "max") ? std::stoull(value) : UINT64_MAX;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::uint64_t read_key(const std::string& path, const char* file, const char* key)
+{
+    auto value = read(path, file);
+    auto size = std::strlen(key);
+
+    for(std::size_t pos = 0; pos < value.size(); )
+    {
+        auto end = value.find('\n', pos);
+        if(end == std::string::npos) end = value.size();
+
+        if(!value.compare(pos, size, key) && value[pos + size] == ' ')
+            return std::stoull(value.substr(pos + size + 1, end - pos - size - 1));
+
+        pos = end + 1;
+    }
+    throw std::system_error(posix::errc::invalid_argument);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool attach(const char* path) noexcept
+{
+    char file[PATH_MAX];
+    auto size = std::strlen(path);
+    if(size + sizeof("/cgroup.procs") > sizeof(file)) return false;
+
+    std::memcpy(file, path, size);
+    std::memcpy(file + size, "/cgroup.procs", sizeof("/cgroup.procs"));
+
+    auto fd = ::open(file, O_WRONLY | O_CLOEXEC);
+    if(fd == -1) return false;
+
+    // "0" means the writing process
+    auto n = ::write(fd, "0", 1);
+    ::close(fd);
+
+    return n == 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool populated(const std::string& path)
+{
+    auto events = read(path, "cgroup.events");
+    return events.find("populated 1") != std::string::npos;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void wait_empty(const std::string& path)
+{
+    // cgroup.events signals POLLPRI when it changes,
+    // but only to readers of the same file description
+    auto fd = ::open((path + "/cgroup.events").data(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1) throw posix::errno_error();
+
+    for(;;)
+    {
+        char buffer[256];
+        auto n = ::pread(fd, buffer, sizeof(buffer) - 1, 0);
+        if(n == -1 && errno == EINTR) continue;
+        if(n == -1)
+        {
+            posix::errno_error error;
+            ::close(fd);
+            throw error;
+        }
+
+        buffer[n] = '\0';
+        if(!std::strstr(buffer, "populated 1")) break;
+
+        pollfd pfd { fd, POLLPRI, 0 };
+        ::poll(&pfd, 1, -1);
+    }
+    ::close(fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
+}
@@ -0,0 +1,62 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_CGROUP_HPP
+#define PGM_CGROUP_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include <cstdint>
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Helpers for cgroup v2 directories.
+//
+namespace cgroup
+{
+
+// create cgroup directory (if it doesn't exist) and check that
+// processes can be moved into it
+bool open(const std::string& path) noexcept;
+
+// enable controllers (eg, "+cpu +memory") for children of cgroup
+bool enable(const std::string& path, const std::string& controllers) noexcept;
+
+// remove (empty) cgroup
+void remove(const std::string& path) noexcept;
+
+// write value to path/file
+void write(const std::string& path, const char* file, const std::string& value);
+// read contents of path/file
+std::string read(const std::string& path, const char* file);
+
+// read single-value file (eg, memory.current)
+std::uint64_t read_value(const std::string& path, const char* file);
+
+// read value of key in flat-keyed file (eg, usage_usec in cpu.stat)
+std::uint64_t read_key(const std::string& path, const char* file, const char* key);
+
+// move calling process into cgroup
+// async-signal-safe, so it can be called between fork and exec
+bool attach(const char* path) noexcept;
+
+// check if cgroup or any of its descendants have live processes
+bool populated(const std::string& path);
+
+// wait until cgroup has no live processes
+void wait_empty(const std::string& path);
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
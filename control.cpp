@@ -0,0 +1,319 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "posix/error.hpp"
+#include "proc/cgroup.hpp"
+#include "proc/control.hpp"
+#include "proc/metrics.hpp"
+#include "proc/reactor.hpp"
+#include "proc/reaper.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <ctime>
+#include <system_error>
+
+#include <linux/futex.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+int pidfd_send_signal(int pidfd, int signal) noexcept
+{
+#ifdef SYS_pidfd_send_signal
+    return ::syscall(SYS_pidfd_send_signal, pidfd, signal, nullptr, 0);
+#else
+    errno = ENOSYS; return -1;
+#endif
+}
+
+static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t),
+    "std::atomic<std::uint32_t> cannot be used as a futex"
+);
+
+void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t value, const timespec* timeout) noexcept
+{
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word),
+        FUTEX_WAIT_PRIVATE, value, timeout, nullptr, 0
+    );
+}
+
+void futex_wake(std::atomic<std::uint32_t>& word) noexcept
+{
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word),
+        FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0
+    );
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+int pidfd_open(pid_t pid) noexcept
+{
+#ifdef SYS_pidfd_open
+    return ::syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS; return -1;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// pidfds are always close-on-exec
+process::control::control(pid_t pid) : pid(pid), pidfd_(pidfd_open(pid)) { }
+
+process::control::~control()
+{
+    reap();
+    if(cgroup.size()) cgroup::remove(cgroup);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool process::control::signal(int signal)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(reaped_) return false;
+
+    // don't count zombies
+    siginfo_t si { };
+    if(!::waitid(P_PID, pid, &si, WEXITED | WNOHANG | WNOWAIT) && si.si_pid) return false;
+
+    // pidfd guards against pid reuse
+    auto code = pidfd_ != -1 ? pidfd_send_signal(pidfd_, signal) : ::kill(pid, signal);
+    if(code)
+    {
+        posix::errno_error error;
+        if(error.code() == std::errc::no_such_process) return false;
+        throw error;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool process::control::with_pid(const std::function<void(pid_t)>& fn)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(reaped_) return false;
+
+    // zombie holds on to its pid until reaped
+    fn(pid);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void process::control::reap() noexcept
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(pidfd_ != -1)
+    {
+        if(watched_) reactor::instance().remove(pidfd_);
+        ::close(pidfd_); pidfd_ = -1;
+    }
+    reaped_ = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool process::control::watch()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(reaped_ || watched_) return true;
+    if(pidfd_ == -1) return false;
+
+    // pidfd becomes readable when the process exits;
+    // the reactor holds on to us until then
+    auto self = shared_from_this();
+    reactor::instance().add(pidfd_, EPOLLIN, [self](std::uint32_t){ self->on_exit(); });
+
+    return watched_ = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void process::control::on_exit()
+{
+    auto noticed = std::chrono::steady_clock::now();
+    try
+    {
+        if(collect()) metrics::observe(metrics::reap_latency, std::chrono::steady_clock::now() - noticed);
+    }
+    catch(...) { }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool process::control::collect()
+{
+    std::uint32_t value;
+    {
+        std::lock_guard<std::mutex> lock(reaping_);
+        if(finished(status().state)) return true;
+
+        // the raw syscall also returns resource usage
+        siginfo_t si { };
+        rusage usage { };
+        if(::syscall(SYS_waitid, P_PID, pid, &si, WEXITED | WNOHANG, &usage))
+        {
+            if(errno != ECHILD) throw posix::errno_error();
+
+            // Nobody else has reaped the process, so this could happen
+            // for the following reasons:
+            // 1. process was never started;
+            // 2. SA_NOCLDWAIT is set or SIGCHLD is set to SIG_IGN.
+            // In case of (2) we don't know if the process exited
+            // normally or due to a signal, so set it to not_started.
+            value = pack(not_started, -1, -1);
+        }
+        else if(!si.si_pid) return false;
+        else
+        {
+            using namespace std::chrono;
+            auto time = [](const timeval& tv){ return seconds(tv.tv_sec) + microseconds(tv.tv_usec); };
+            cpu_time = time(usage.ru_utime) + time(usage.ru_stime);
+
+            value = si.si_code == CLD_EXITED ? pack(exited, si.si_status, -1) : pack(signaled, -1, si.si_status);
+        }
+
+        reap();
+        status_.store(value, std::memory_order_release);
+    }
+
+    finish(value);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void process::control::finish(std::uint32_t value)
+{
+    auto status = unpack(value);
+
+    metrics::finished();
+    metrics::observe(metrics::lifetime, std::chrono::steady_clock::now() - started);
+    if(status.state == signaled) metrics::signaled(status.signal);
+
+    futex_wake(status_);
+
+    std::vector<continuation> then;
+    std::vector<std::shared_ptr<void>> leases;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        then.swap(then_);
+        leases.swap(this->leases);
+    }
+
+    for(auto& fn : then) try { fn(status); } catch(...) { }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void process::control::then(continuation fn)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    auto status = this->status();
+    if(finished(status.state))
+    {
+        lock.unlock();
+        reactor::instance().post([=]{ fn(status); });
+    }
+    else then_.push_back(std::move(fn));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void process::control::wait() const noexcept
+{
+    for(;;)
+    {
+        auto value = status_.load(std::memory_order_acquire);
+        if(finished(unpack(value).state)) break;
+
+        futex_wait(status_, value, nullptr);
+    }
+}
+
+void process::control::join()
+{
+    if(watched_) return wait();
+
+    // wait without reaping, so that the reactor can still collect
+    // the process, if it starts watching it in the meantime
+    while(!collect())
+    {
+        siginfo_t si;
+        if(::waitid(P_PID, pid, &si, WEXITED | WNOWAIT))
+        {
+            // ECHILD is handled by collect()
+            posix::errno_error error;
+            if(error.code() != std::errc::interrupted
+                && error.code() != std::errc::no_child_process) throw error;
+        }
+    }
+}
+
+bool process::control::wait_for(const std::chrono::nanoseconds& time) const noexcept
+{
+    auto until = std::chrono::steady_clock::now() + time;
+    for(;;)
+    {
+        auto value = status_.load(std::memory_order_acquire);
+        if(finished(unpack(value).state)) return true;
+
+        auto left = until - std::chrono::steady_clock::now();
+        if(left <= left.zero()) return false;
+
+        auto sec = std::chrono::duration_cast<std::chrono::seconds>(left);
+        auto nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(left - sec);
+        timespec ts { static_cast<time_t>(sec.count()), static_cast<long>(nsec.count()) };
+
+        futex_wait(status_, value, &ts);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::uint32_t process::control::pack(pgm::state state, int code, int signal) noexcept
+{
+    return std::uint32_t(state & 0xff)
+        | std::uint32_t(code & 0xff) << 8
+        | std::uint32_t(signal & 0xff) << 16;
+}
+
+exit_status process::control::unpack(std::uint32_t value) noexcept
+{
+    exit_status status { static_cast<pgm::state>(value & 0xff) };
+    if(status.state == exited) status.code = (value >> 8) & 0xff;
+    if(status.state == signaled || status.state == stopped) status.signal = (value >> 16) & 0xff;
+    return status;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+std::atomic<bool> reaper_enabled { false };
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+namespace reaper
+{
+
+void enable() noexcept { reaper_enabled = true; }
+void disable() noexcept { reaper_enabled = false; }
+bool enabled() noexcept { return reaper_enabled; }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,149 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_CONTROL_HPP
+#define PGM_CONTROL_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/process.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Process state shared with the reactor.
+//
+// Unlike the process object it doesn't move around, so it can be
+// safely referenced from timers and other callbacks.
+//
+struct process::control : std::enable_shared_from_this<process::control>
+{
+    ////////////////////
+    explicit control(pid_t);
+    ~control();
+
+    control(const control&) = delete;
+    control& operator=(const control&) = delete;
+
+    ////////////////////
+    // send signal to process unless it's been reaped
+    // returns false if the process is gone
+    bool signal(int);
+
+    // call fn with pid unless the process has been reaped,
+    // so that the pid cannot be reused in the meantime
+    // returns false if the process is gone
+    bool with_pid(const std::function<void(pid_t)>& fn);
+
+    // mark process as reaped
+    void reap() noexcept;
+
+    ////////////////////
+    // have the reactor reap the process as soon as it exits
+    // returns false if not supported
+    bool watch();
+    bool watched() const noexcept { return watched_; }
+
+    ////////////////////
+    // get last published status
+    // lock-free and safe to call from any thread
+    exit_status status() const noexcept { return unpack(status_); }
+
+    // reap process if it exited, publish its status and run continuations
+    // returns false if the process is still running
+    //
+    // Called by the reactor or by the process, whichever gets to it first.
+    // Calls are serialized, so that the status is published exactly once
+    // and ECHILD only means that nobody has reaped the process.
+    bool collect();
+
+    // wait for process to finish (on a futex)
+    void wait() const noexcept;
+
+    // wait for process to finish and collect it, if not watched
+    void join();
+    bool wait_for(const std::chrono::nanoseconds&) const noexcept;
+
+    // call fn on the reactor thread once exit status is published
+    void then(continuation fn);
+
+    // -1 if reaped or not supported
+    int pidfd() const noexcept { return pidfd_; }
+
+    ////////////////////
+    const pid_t pid;
+
+    // when process was started
+    const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+    std::atomic<pgm::escalation> escalation { pgm::escalation::none };
+    std::atomic<pgm::overrun> overrun { pgm::overrun::none };
+
+    // hard RLIMIT_CPU of process, in seconds
+    std::atomic<rlim_t> cpu_limit { RLIM_INFINITY };
+
+    // CPU time used by process (set when reaped)
+    std::chrono::microseconds cpu_time { 0 };
+
+    // cgroup created for process (removed on destruction)
+    std::string cgroup;
+
+    // resources held by process until it finishes
+    // (eg, placement slot or jobserver token)
+    std::vector<std::shared_ptr<void>> leases;
+
+private:
+    ////////////////////
+    std::mutex mutex_;
+    int pidfd_ = -1;
+    bool reaped_ = false;
+
+    std::mutex reaping_; // serializes collect()
+
+    ////////////////////
+    std::atomic<bool> watched_ { false };
+
+    // packed exit_status: state in bits 0-7, code in 8-15
+    // and signal in 16-23, so that it can be used as a futex
+    mutable std::atomic<std::uint32_t> status_ { running };
+    std::vector<continuation> then_;
+
+    static std::uint32_t pack(pgm::state, int code, int signal) noexcept;
+    static exit_status unpack(std::uint32_t) noexcept;
+
+    void on_exit();
+    void finish(std::uint32_t value);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// check if process has finished
+inline bool finished(pgm::state state) noexcept
+{ return state != running && state != stopped; }
+
+////////////////////////////////////////////////////////////////////////////////
+// open pidfd of process (see pidfd_open(2))
+// returns -1 and sets errno on error
+int pidfd_open(pid_t) noexcept;
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
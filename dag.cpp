@@ -0,0 +1,366 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "posix/error.hpp"
+#include "proc/charpp.hpp"
+#include "proc/dag.hpp"
+#include "proc/drain.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+dag::node dag::add(command cmd, double cost)
+{
+    if(cmd.empty()) throw std::system_error(posix::errc::invalid_argument);
+
+    return add([cmd = std::move(cmd)]()
+    {
+        auto args = make_charpp(cmd.begin(), cmd.end());
+        ::execvp(args[0], args.get());
+        return 127; // like the shell
+    }, cost);
+}
+
+dag::node dag::add(function fn, double cost)
+{
+    nodes_.push_back(entry { std::move(fn), cost, { }, { } });
+    return nodes_.size() - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void dag::depend(node job, node on)
+{
+    if(job >= size() || on >= size() || job == on)
+        throw std::system_error(posix::errc::invalid_argument);
+
+    nodes_[job].deps.push_back(on);
+    nodes_[on].dependents.push_back(job);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Dispatcher thread's queue of ready jobs (max-heap by priority).
+//
+struct dag::worker
+{
+    std::mutex mutex;
+    std::vector<node> queue;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// State of a run shared between dispatcher threads.
+//
+struct dag::state
+{
+    ////////////////////
+    const spawn_options& options;
+    on_failure policy;
+
+    std::vector<result> results;
+    std::vector<char> resolved; // set by the thread which took the job
+
+    // number of dependencies, which haven't succeeded yet
+    std::unique_ptr<std::atomic<std::size_t>[]> pending;
+
+    std::vector<std::unique_ptr<worker>> workers;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    ////////////////////
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::size_t ready = 0;   // jobs in queues
+    std::size_t running = 0; // jobs taken out of queues
+
+    std::atomic<bool> cancelled { false };
+    int cancel_fd = -1; // eventfd, readable once cancelled
+
+    ////////////////////
+    state(const spawn_options& o, on_failure p) : options(o), policy(p) { }
+    ~state() { if(cancel_fd != -1) ::close(cancel_fd); }
+
+    std::chrono::nanoseconds now() const { return std::chrono::steady_clock::now() - epoch; }
+
+    void push(std::size_t index, node);
+    bool pop(std::size_t index, node&);
+    void cancel();
+};
+
+////////////////////////////////////////////////////////////////////////////////
+void dag::state::push(std::size_t index, node n)
+{
+    auto less = [&](node x, node y){ return results[x].priority < results[y].priority; };
+
+    results[n].ready = now();
+    {
+        auto& w = *workers[index];
+        std::lock_guard<std::mutex> lock(w.mutex);
+
+        w.queue.push_back(n);
+        std::push_heap(w.queue.begin(), w.queue.end(), less);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ++ready;
+    changed.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool dag::state::pop(std::size_t index, node& n)
+{
+    auto less = [&](node x, node y){ return results[x].priority < results[y].priority; };
+
+    auto take = [&](worker& w)
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if(w.queue.empty()) return false;
+
+        std::pop_heap(w.queue.begin(), w.queue.end(), less);
+        n = w.queue.back();
+        w.queue.pop_back();
+        return true;
+    };
+
+    // own queue first, then steal the most important job of the others
+    auto found = take(*workers[index]);
+    while(!found)
+    {
+        worker* victim = nullptr;
+        double best = 0;
+
+        for(std::size_t i = 1; i < workers.size(); ++i)
+        {
+            auto& w = *workers[(index + i) % workers.size()];
+
+            std::lock_guard<std::mutex> lock(w.mutex);
+            if(w.queue.size() && (!victim || results[w.queue.front()].priority > best))
+            {
+                victim = &w;
+                best = results[w.queue.front()].priority;
+            }
+        }
+        if(!victim) return false;
+
+        found = take(*victim);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    --ready;
+    ++running;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void dag::state::cancel()
+{
+    if(cancelled.exchange(true)) return;
+
+    std::uint64_t one = 1;
+    ::write(cancel_fd, &one, sizeof(one));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    changed.notify_all();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<dag::result> dag::run(std::size_t threads, const spawn_options& options, on_failure policy)
+{
+    if(!threads) throw std::system_error(posix::errc::invalid_argument);
+
+    ////////////////////
+    // topological order
+    std::vector<node> order;
+    std::vector<std::size_t> count(size());
+    for(node n = 0; n < size(); ++n)
+    {
+        count[n] = nodes_[n].deps.size();
+        if(!count[n]) order.push_back(n);
+    }
+    for(std::size_t i = 0; i < order.size(); ++i)
+        for(auto d : nodes_[order[i]].dependents)
+            if(!--count[d]) order.push_back(d);
+
+    if(order.size() != size()) throw std::system_error(posix::errc::invalid_argument);
+
+    ////////////////////
+    state st(options, policy);
+    st.results.resize(size());
+    st.resolved.resize(size());
+
+    // critical path length from each job
+    for(auto it = order.rbegin(); it != order.rend(); ++it)
+    {
+        double longest = 0;
+        for(auto d : nodes_[*it].dependents) longest = std::max(longest, st.results[d].priority);
+        st.results[*it].priority = nodes_[*it].cost + longest;
+    }
+
+    st.pending.reset(new std::atomic<std::size_t>[size()]);
+    for(node n = 0; n < size(); ++n) st.pending[n] = nodes_[n].deps.size();
+
+    st.cancel_fd = ::eventfd(0, EFD_CLOEXEC);
+    if(st.cancel_fd == -1) throw posix::errno_error();
+
+    for(std::size_t i = 0; i < threads; ++i) st.workers.emplace_back(new worker());
+
+    ////////////////////
+    // deal jobs without dependencies to threads, most important first
+    std::vector<node> roots;
+    for(auto n : order) if(nodes_[n].deps.empty()) roots.push_back(n);
+
+    std::stable_sort(roots.begin(), roots.end(),
+        [&](node x, node y){ return st.results[x].priority > st.results[y].priority; }
+    );
+    for(std::size_t i = 0; i < roots.size(); ++i) st.push(i % threads, roots[i]);
+
+    std::vector<std::thread> dispatchers;
+    for(std::size_t i = 0; i < threads; ++i)
+        dispatchers.emplace_back(&dag::dispatch, this, std::ref(st), i);
+
+    for(auto& th : dispatchers) th.join();
+
+    ////////////////////
+    // jobs that were never taken
+    for(auto n : order)
+    {
+        if(st.resolved[n]) continue;
+
+        auto& r = st.results[n];
+        r.outcome = st.cancelled ? cancelled : skipped;
+
+        for(auto d : nodes_[n].deps)
+        {
+            auto o = st.results[d].outcome;
+            if(o == failed || o == skipped) { r.outcome = skipped; break; }
+        }
+    }
+
+    return std::move(st.results);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void dag::dispatch(state& st, std::size_t index)
+{
+    for(;;)
+    {
+        node n;
+        if(!st.pop(index, n))
+        {
+            std::unique_lock<std::mutex> lock(st.mutex);
+
+            // nothing is queued or running, so nothing more will be
+            if(!st.ready && !st.running) { st.changed.notify_all(); return; }
+
+            st.changed.wait(lock, [&]{ return st.ready || !st.running; });
+            continue;
+        }
+
+        st.resolved[n] = true;
+        if(st.cancelled) st.results[n].outcome = cancelled;
+        else
+        {
+            execute(st, n);
+
+            auto& r = st.results[n];
+            if(r.outcome == succeeded)
+            {
+                for(auto d : nodes_[n].dependents)
+                    if(!--st.pending[d]) st.push(index, d);
+            }
+            else if(st.policy == cancel) st.cancel();
+        }
+
+        std::lock_guard<std::mutex> lock(st.mutex);
+        --st.running;
+        if(!st.ready && !st.running) st.changed.notify_all();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void dag::execute(state& st, node n)
+{
+    auto& r = st.results[n];
+    r.start = st.now();
+
+    process p;
+    try
+    {
+        p = process(st.options, [&]()
+        {
+            // jobs don't get stdin, unless it's redirected from file
+            if(st.options.in.path.empty())
+            {
+                auto null = ::open("/dev/null", O_RDONLY);
+                if(null != -1) { ::dup2(null, STDIN_FILENO); ::close(null); }
+            }
+
+            return nodes_[n].fn();
+        });
+    }
+    catch(std::exception& e)
+    {
+        r.err = e.what();
+        r.finish = st.now();
+        r.outcome = failed;
+        return;
+    }
+
+    ////////////////////
+    // collect output until the process closes its end of the pipes
+    bool terminated = false;
+    collect(p, r.out, r.err, st.cancel_fd, [&]{ p.terminate(); terminated = true; });
+
+    p.join();
+    r.finish = st.now();
+    r.status = p.status();
+
+    if(r.status.state == exited && r.status.code == 0) r.outcome = succeeded;
+    else r.outcome = terminated ? cancelled : failed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<dag::node> dag::critical_path(const std::vector<result>& results) const
+{
+    if(results.size() != size()) throw std::system_error(posix::errc::invalid_argument);
+
+    std::vector<node> path;
+
+    auto later = [&](node x, node y){ return results[x].finish < results[y].finish; };
+    auto pick = [&](const std::vector<node>& nodes)
+    {
+        auto it = std::max_element(nodes.begin(), nodes.end(), later);
+        if(it != nodes.end() && results[*it].finish.count()) path.push_back(*it);
+        return it != nodes.end() && results[*it].finish.count();
+    };
+
+    std::vector<node> all(size());
+    for(node n = 0; n < size(); ++n) all[n] = n;
+
+    // last one to finish and then the last dependency of each
+    if(pick(all)) while(pick(nodes_[path.back()].deps));
+
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,113 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_DAG_HPP
+#define PGM_DAG_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/process.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Graph of jobs with dependencies between them.
+//
+// A job is started once all jobs it depends on have succeeded. Jobs
+// are started by a number of dispatcher threads, each of which runs one
+// job at a time. Every thread has its own queue of ready jobs, which it
+// fills with jobs released by the ones it ran and which idle threads
+// steal from.
+//
+// Ready jobs are taken in order of their priority, which is the longest
+// path (by cost) from the job to the end of the graph, so that jobs
+// on the critical path go first.
+//
+class dag
+{
+public:
+    ////////////////////
+    using node = std::size_t;
+    using command = std::vector<std::string>; // run with execvp(3)
+    using function = std::function<int()>;    // run in child process
+
+    // add job with estimated cost (eg, its expected run time)
+    node add(command, double cost = 1);
+    node add(function, double cost = 1);
+
+    // make job wait for another one to succeed
+    void depend(node job, node on);
+
+    // get number of jobs
+    std::size_t size() const noexcept { return nodes_.size(); }
+
+    ////////////////////
+    enum on_failure
+    {
+        keep_going, // run everything that doesn't depend on failed jobs
+        cancel,     // don't start new jobs and terminate running ones
+    };
+
+    enum outcome
+    {
+        succeeded,
+        failed,    // exited with non-zero code, signaled or not started
+        skipped,   // depends on job that didn't succeed
+        cancelled, // not started or terminated due to cancel
+    };
+
+    struct result
+    {
+        pgm::dag::outcome outcome = skipped;
+        exit_status status;
+        std::string out, err; // captured stdout & stderr
+
+        double priority = 0; // critical path length from this job
+
+        // since run() was called (0 if not started)
+        std::chrono::nanoseconds ready { }, start { }, finish { };
+    };
+
+    // run all jobs with at most threads of them at a time and
+    // return their results indexed by node
+    //
+    // Throws std::system_error with errc::invalid_argument if the graph
+    // has cycles.
+    std::vector<result> run(std::size_t threads, const spawn_options& = { }, on_failure = keep_going);
+
+    // get critical path of the finished run: chain of jobs, which
+    // ends last and where each one was held up by the one before
+    std::vector<node> critical_path(const std::vector<result>&) const;
+
+private:
+    ////////////////////
+    struct entry
+    {
+        function fn;
+        double cost;
+        std::vector<node> deps, dependents;
+    };
+    std::vector<entry> nodes_;
+
+    struct state;
+    struct worker;
+    void dispatch(state&, std::size_t index);
+    void execute(state&, node);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
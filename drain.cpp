@@ -0,0 +1,69 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/drain.hpp"
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+int drain(int fd, std::string& s)
+{
+    char buffer[64 * 1024];
+    for(;;)
+    {
+        auto n = ::read(fd, buffer, sizeof(buffer));
+        if(n > 0) { s.append(buffer, n); continue; }
+
+        if(n == -1 && errno == EINTR) continue;
+        return n;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void collect(process& p, std::string& out, std::string& err,
+    int cancel_fd, const std::function<void()>& cancel)
+{
+    int fds[] = { p.fd(p.cout), p.fd(p.cerr) };
+    std::string* to[] = { &out, &err };
+
+    // so that we don't block on one while the other fills up
+    for(auto fd : fds) if(fd != -1) ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    while(fds[0] != -1 || fds[1] != -1)
+    {
+        pollfd pfds[] = {
+            { fds[0], POLLIN, 0 },
+            { fds[1], POLLIN, 0 },
+            { cancel_fd, POLLIN, 0 },
+        };
+        if(::poll(pfds, 3, -1) == -1)
+        {
+            if(errno == EINTR) continue;
+            break;
+        }
+
+        if(pfds[2].revents)
+        {
+            cancel_fd = -1;
+            if(cancel) cancel();
+        }
+
+        for(auto i = 0; i < 2; ++i)
+            if(pfds[i].revents && !(drain(fds[i], *to[i]) == -1 && errno == EAGAIN)) fds[i] = -1;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
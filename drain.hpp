@@ -0,0 +1,43 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_DRAIN_HPP
+#define PGM_DRAIN_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/process.hpp"
+
+#include <functional>
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Read from fd until it reaches end of file or would block
+// (if it's non-blocking) and append what was read to s.
+//
+// Returns 0 on end of file or -1 on error, in which case errno is set
+// (to EAGAIN if it would block).
+//
+int drain(int fd, std::string& s);
+
+////////////////////////////////////////////////////////////////////////////////
+// Read stdout and stderr of process until it closes both of them.
+//
+// If cancel_fd is given and becomes readable, calls cancel() once
+// and keeps reading. Streams redirected to files are skipped.
+//
+void collect(process&, std::string& out, std::string& err,
+    int cancel_fd = -1, const std::function<void()>& cancel = { });
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
@@ -0,0 +1,62 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_FRAMING_HPP
+#define PGM_FRAMING_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Describes how records are framed in a stream (see process::for_each_record).
+//
+// Records that fit into the stream buffer are passed as views into it.
+// Larger records are copied into a side buffer, up to max_size bytes
+// (64 MiB by default, so that output of a child can't make us allocate
+// any amount of memory).
+//
+struct framing
+{
+    ////////////////////
+    enum type
+    {
+        delimiter, // records separated by delim
+        u32,       // 32-bit little-endian length prefix
+        varint,    // LEB128 (protobuf-style) length prefix
+        packet,    // one record per write (pipe in packet mode)
+    };
+
+    enum type type = delimiter;
+    char delim = '\n';
+
+    // max record size
+    static constexpr std::size_t default_max = 64 << 20;
+    std::size_t max_size = default_max;
+
+    ////////////////////
+    static framing by_delimiter(char c, std::size_t max = default_max) noexcept
+    { return framing { delimiter, c, max }; }
+
+    static framing by_u32(std::size_t max = default_max) noexcept
+    { return framing { u32, 0, max }; }
+
+    static framing by_varint(std::size_t max = default_max) noexcept
+    { return framing { varint, 0, max }; }
+
+    static framing by_packet(std::size_t max = default_max) noexcept
+    { return framing { packet, 0, max }; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
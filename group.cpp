@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "posix/error.hpp"
+#include "proc/cgroup.hpp"
+#include "proc/control.hpp"
+#include "proc/group.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <system_error>
+#include <thread>
+
+#include <signal.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+group::group(std::string cgroup)
+{
+    if(cgroup::open(cgroup)) cgroup_ = std::move(cgroup);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+pid_t group::pgid() const noexcept
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pgid_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t group::size()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    prune();
+    return members_.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void group::raise(int signal)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // cgroup.kill (Linux 5.14+) kills everything in the cgroup
+    if(signal == SIGKILL && cgroup_.size())
+    {
+        try { cgroup::write(cgroup_, "cgroup.kill", "1"); return; }
+        catch(std::system_error&) { }
+    }
+
+    if(pgid_ && ::killpg(pgid_, signal))
+    {
+        posix::errno_error error;
+        if(error.code() != std::errc::no_such_process) throw error;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void group::join()
+{
+    std::vector<std::shared_ptr<process::control>> members;
+    pid_t pgid;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        members = members_;
+        pgid = pgid_;
+    }
+
+    // collect members that are not watched (eg, no pidfd support),
+    // as their zombies would keep the process group alive
+    for(auto& ctl : members) ctl->join();
+
+    if(cgroup_.size()) cgroup::wait_empty(cgroup_);
+    else if(pgid)
+    {
+        // there is no way to wait for descendants that are not our children
+        using namespace std::chrono_literals;
+        while(::killpg(pgid, 0) == 0) std::this_thread::sleep_for(10ms);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    prune();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void group::prune()
+{
+    members_.erase(std::remove_if(members_.begin(), members_.end(),
+        [](auto& ctl){ return finished(ctl->status().state); }),
+        members_.end()
+    );
+
+    // process group is gone with the last member
+    // (unless some descendants are still around)
+    if(members_.empty() && pgid_ && ::killpg(pgid_, 0)) pgid_ = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,89 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_GROUP_HPP
+#define PGM_GROUP_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/process.hpp"
+
+#include <csignal>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Group of processes, which can be signalled and waited for as a whole.
+//
+// Processes are added to the group by passing it in spawn_options.
+// The first one becomes the leader of a new process group and the rest
+// join it. Optionally, members are also placed into a cgroup v2
+// directory, which catches descendants that leave the process group.
+//
+// Members are watched by the reaper (see reaper.hpp), but still
+// have to be joined through their process objects.
+//
+class group
+{
+public:
+    ////////////////////
+    // use process group only
+    group() = default;
+
+    // use process group and cgroup at path, which is created
+    // if it doesn't exist; if the cgroup is not writable
+    // falls back to using process group only
+    explicit group(std::string cgroup);
+
+    group(const group&) = delete;
+    group& operator=(const group&) = delete;
+
+    ////////////////////
+    // get process group id (0 if no members were added yet)
+    pid_t pgid() const noexcept;
+
+    // get cgroup path (empty if not used)
+    const std::string& cgroup() const noexcept { return cgroup_; }
+
+    // get number of live members
+    std::size_t size();
+
+    ////////////////////
+    // send signal to all members and their descendants
+    void raise(int);
+    void terminate() { raise(SIGTERM); }
+    void kill() { raise(SIGKILL); }
+
+    // wait for all members and their descendants to finish
+    void join();
+
+private:
+    ////////////////////
+    mutable std::mutex mutex_;
+
+    pid_t pgid_ = 0;
+    std::string cgroup_;
+    std::vector<std::shared_ptr<process::control>> members_;
+
+    void prune();
+
+    friend class process;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
@@ -0,0 +1,575 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "posix/error.hpp"
+#include "proc/control.hpp"
+#include "proc/io_engine.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+struct io_engine::backend
+{
+    virtual ~backend() = default;
+
+    virtual bool uring() const noexcept = 0;
+
+    virtual void read(int fd, void* data, std::size_t size, handler) = 0;
+    virtual void write(int fd, const void* data, std::size_t size, handler) = 0;
+    virtual void wait_exit(pid_t, handler) = 0;
+
+    virtual std::size_t run_once(std::chrono::milliseconds) = 0;
+    virtual std::size_t pending() const noexcept = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+// call handlers of completed operations
+// (they may queue new ones and shouldn't throw)
+std::size_t complete(std::vector<std::pair<io_engine::handler, int>>& done)
+{
+    for(auto& [fn, result] : done) try { fn(result); } catch(...) { }
+    return done.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// io_uring backend using raw system calls.
+//
+class uring_backend : public io_engine::backend
+{
+public:
+    ////////////////////
+    // returns nullptr if io_uring or required features are not available
+    static std::unique_ptr<uring_backend> create(unsigned entries);
+    ~uring_backend() override;
+
+    bool uring() const noexcept override { return true; }
+
+    void read(int fd, void* data, std::size_t size, io_engine::handler fn) override
+    { queue(IORING_OP_READ, fd, data, size, std::move(fn)); }
+
+    void write(int fd, const void* data, std::size_t size, io_engine::handler fn) override
+    { queue(IORING_OP_WRITE, fd, const_cast<void*>(data), size, std::move(fn)); }
+
+    void wait_exit(pid_t, io_engine::handler) override;
+
+    std::size_t run_once(std::chrono::milliseconds) override;
+    std::size_t pending() const noexcept override { return pending_; }
+
+private:
+    ////////////////////
+    uring_backend() = default;
+
+    // IORING_OP_WAITID (Linux 6.7), which older headers don't have
+    static constexpr std::uint8_t op_waitid = 50;
+
+    struct op
+    {
+        io_engine::handler fn;
+        bool exit = false;
+        int pidfd = -1;
+        siginfo_t info { };
+    };
+
+    int fd_ = -1;
+    bool waitid_ = false;
+
+    void* sq_ = MAP_FAILED; std::size_t sq_size_ = 0;
+    void* cq_ = MAP_FAILED; std::size_t cq_size_ = 0;
+    io_uring_sqe* sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED); std::size_t sqes_size_ = 0;
+
+    unsigned *sq_head_, *sq_tail_, *sq_array_, sq_mask_, sq_entries_;
+    unsigned *cq_head_, *cq_tail_, cq_mask_;
+    io_uring_cqe* cqes_;
+
+    unsigned tail_ = 0;   // local copy of sq tail
+    unsigned queued_ = 0; // not submitted yet
+    std::size_t pending_ = 0;
+
+    io_uring_sqe* next();
+    void queue(std::uint8_t opcode, int fd, void* data, std::size_t size, io_engine::handler);
+    int enter(unsigned submit, unsigned wait, unsigned flags, const void* arg, std::size_t);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+std::unique_ptr<uring_backend> uring_backend::create(unsigned entries)
+{
+    std::unique_ptr<uring_backend> ring(new uring_backend());
+
+    io_uring_params p { };
+    p.flags = IORING_SETUP_CLAMP;
+
+    ring->fd_ = ::syscall(SYS_io_uring_setup, entries, &p);
+    if(ring->fd_ == -1) return nullptr;
+
+    // need timeouts for run_once()
+    if(!(p.features & IORING_FEAT_EXT_ARG)) return nullptr;
+
+    ////////////////////
+    std::vector<char> buffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    auto probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+    if(::syscall(SYS_io_uring_register, ring->fd_, IORING_REGISTER_PROBE, probe, 256)) return nullptr;
+
+    auto supported = [&](unsigned op)
+    { return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED); };
+
+    if(!supported(IORING_OP_READ) || !supported(IORING_OP_WRITE) || !supported(IORING_OP_POLL_ADD))
+        return nullptr;
+    ring->waitid_ = supported(op_waitid);
+
+    ////////////////////
+    ring->sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+    // both rings in one mapping (Linux 5.4+)
+    auto single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single) ring->sq_size_ = ring->cq_size_ = std::max(ring->sq_size_, ring->cq_size_);
+
+    ring->sq_ = ::mmap(nullptr, ring->sq_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd_, IORING_OFF_SQ_RING);
+    if(ring->sq_ == MAP_FAILED) return nullptr;
+
+    if(single) ring->cq_ = ring->sq_;
+    else
+    {
+        ring->cq_ = ::mmap(nullptr, ring->cq_size_, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd_, IORING_OFF_CQ_RING);
+        if(ring->cq_ == MAP_FAILED) return nullptr;
+    }
+
+    ring->sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes_ = static_cast<io_uring_sqe*>(::mmap(nullptr, ring->sqes_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd_, IORING_OFF_SQES));
+    if(ring->sqes_ == MAP_FAILED) return nullptr;
+
+    ////////////////////
+    auto sq = static_cast<char*>(ring->sq_);
+    ring->sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    ring->sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    ring->sq_array_= reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    ring->sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    ring->sq_entries_ = p.sq_entries;
+    ring->tail_ = *ring->sq_tail_;
+
+    auto cq = static_cast<char*>(ring->cq_);
+    ring->cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    ring->cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    ring->cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    ring->cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+    ////////////////////
+    // the destructor cancels with IORING_ASYNC_CANCEL_ANY (Linux 5.19),
+    // which older kernels reject with EINVAL and then it would wait forever
+    auto sqe = ring->next();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    __atomic_store_n(ring->sq_tail_, ++ring->tail_, __ATOMIC_RELEASE);
+
+    int n;
+    do n = ring->enter(1, 1, IORING_ENTER_GETEVENTS, nullptr, _NSIG / 8);
+    while(n == -1 && errno == EINTR);
+    if(n != 1) return nullptr;
+
+    auto head = *ring->cq_head_;
+    if(head == __atomic_load_n(ring->cq_tail_, __ATOMIC_ACQUIRE)) return nullptr;
+
+    auto res = ring->cqes_[head & ring->cq_mask_].res;
+    __atomic_store_n(ring->cq_head_, head + 1, __ATOMIC_RELEASE);
+    if(res == -EINVAL) return nullptr;
+
+    return ring;
+}
+
+uring_backend::~uring_backend()
+{
+    // cancel operations in flight and wait for them to finish,
+    // as they may still write into buffers and ops
+    if(pending_) try
+    {
+        auto sqe = next();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+        sqe->user_data = 0;
+
+        __atomic_store_n(sq_tail_, ++tail_, __ATOMIC_RELEASE);
+        ++queued_;
+
+        while(pending_ || queued_)
+        {
+            auto n = enter(queued_, 1, IORING_ENTER_GETEVENTS, nullptr, _NSIG / 8);
+            if(n == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) break;
+            if(n > 0) queued_ -= std::min<unsigned>(n, queued_);
+
+            auto head = *cq_head_;
+            auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            for(; head != tail; ++head)
+                if(auto o = reinterpret_cast<op*>(cqes_[head & cq_mask_].user_data))
+                {
+                    if(o->pidfd != -1) ::close(o->pidfd);
+                    delete o;
+                    --pending_;
+                }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        }
+    }
+    catch(...) { }
+
+    if(sqes_ != MAP_FAILED) ::munmap(sqes_, sqes_size_);
+    if(cq_ != MAP_FAILED && cq_ != sq_) ::munmap(cq_, cq_size_);
+    if(sq_ != MAP_FAILED) ::munmap(sq_, sq_size_);
+    if(fd_ != -1) ::close(fd_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+int uring_backend::enter(unsigned submit, unsigned wait, unsigned flags, const void* arg, std::size_t size)
+{
+    return ::syscall(SYS_io_uring_enter, fd_, submit, wait, flags, arg, size);
+}
+
+io_uring_sqe* uring_backend::next()
+{
+    // submission ring is full: submit what we have
+    while(tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_)
+    {
+        auto n = enter(queued_, 0, 0, nullptr, 0);
+        if(n == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) throw posix::errno_error();
+        if(n > 0) queued_ -= n;
+    }
+
+    auto index = tail_ & sq_mask_;
+    auto sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    return sqe;
+}
+
+void uring_backend::queue(std::uint8_t opcode, int fd, void* data, std::size_t size, io_engine::handler fn)
+{
+    auto sqe = next();
+    std::unique_ptr<op> o(new op { std::move(fn) });
+
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->off = static_cast<__u64>(-1); // current position (pipes don't have one)
+    sqe->addr = reinterpret_cast<std::uintptr_t>(data);
+    sqe->len = static_cast<__u32>(std::min<std::size_t>(size, INT_MAX));
+    sqe->user_data = reinterpret_cast<std::uintptr_t>(o.release());
+
+    __atomic_store_n(sq_tail_, ++tail_, __ATOMIC_RELEASE);
+    ++queued_;
+    ++pending_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void uring_backend::wait_exit(pid_t pid, io_engine::handler fn)
+{
+    auto sqe = next();
+    std::unique_ptr<op> o(new op { std::move(fn), true });
+
+    if(waitid_)
+    {
+        // WNOWAIT leaves the process to be reaped by process::join()
+        sqe->opcode = op_waitid;
+        sqe->fd = pid;
+        sqe->len = P_PID;
+        sqe->file_index = WEXITED | WNOWAIT;
+        sqe->addr2 = reinterpret_cast<std::uintptr_t>(&o->info);
+    }
+    else
+    {
+        // sqe isn't submitted until tail_ moves, so it's ok to throw here
+        o->pidfd = pidfd_open(pid);
+        if(o->pidfd == -1) throw posix::errno_error();
+
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = o->pidfd;
+        sqe->poll32_events = POLLIN;
+    }
+    sqe->user_data = reinterpret_cast<std::uintptr_t>(o.release());
+
+    __atomic_store_n(sq_tail_, ++tail_, __ATOMIC_RELEASE);
+    ++queued_;
+    ++pending_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t uring_backend::run_once(std::chrono::milliseconds timeout)
+{
+    auto ready = [&]{ return __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) != *cq_head_; };
+
+    ////////////////////
+    // submit and wait in one go, unless something has completed already
+    unsigned wait = pending_ && !ready() ? 1 : 0;
+    if(queued_ || wait)
+    {
+        unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+
+        __kernel_timespec ts { };
+        io_uring_getevents_arg arg { };
+        if(wait && timeout.count() >= 0)
+        {
+            ts.tv_sec = timeout.count() / 1000;
+            ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+            arg.sigmask_sz = _NSIG / 8;
+            arg.ts = reinterpret_cast<std::uintptr_t>(&ts);
+            flags |= IORING_ENTER_EXT_ARG;
+        }
+
+        auto n = flags & IORING_ENTER_EXT_ARG ? enter(queued_, wait, flags, &arg, sizeof(arg))
+                                              : enter(queued_, wait, flags, nullptr, _NSIG / 8);
+        if(n == -1)
+        {
+            if(errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY)
+                throw posix::errno_error();
+        }
+        else queued_ -= std::min<unsigned>(n, queued_);
+    }
+
+    ////////////////////
+    // collect all completions before calling handlers
+    std::vector<std::pair<io_engine::handler, int>> done;
+
+    auto head = *cq_head_;
+    auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for(; head != tail; ++head)
+    {
+        auto& cqe = cqes_[head & cq_mask_];
+        std::unique_ptr<op> o(reinterpret_cast<op*>(cqe.user_data));
+
+        auto result = cqe.res;
+        if(o->exit && result > 0) result = 0; // poll mask
+        if(o->pidfd != -1) ::close(o->pidfd);
+
+        done.emplace_back(std::move(o->fn), result);
+        --pending_;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+    return complete(done);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// epoll backend for kernels without (usable) io_uring.
+//
+class epoll_backend : public io_engine::backend
+{
+public:
+    ////////////////////
+    epoll_backend() : epoll_(::epoll_create1(EPOLL_CLOEXEC))
+    { if(epoll_ == -1) throw posix::errno_error(); }
+
+    ~epoll_backend() override
+    {
+        for(auto& each : fds_)
+            for(auto& o : each.second.reads) if(o.exit) ::close(each.first);
+        ::close(epoll_);
+    }
+
+    bool uring() const noexcept override { return false; }
+
+    void read(int fd, void* data, std::size_t size, io_engine::handler fn) override
+    { queue(fd, &entry::reads, op { std::move(fn), static_cast<char*>(data), size }); }
+
+    void write(int fd, const void* data, std::size_t size, io_engine::handler fn) override
+    { queue(fd, &entry::writes, op { std::move(fn), static_cast<char*>(const_cast<void*>(data)), size }); }
+
+    void wait_exit(pid_t pid, io_engine::handler fn) override
+    {
+        // pidfd becomes readable when the process exits
+        auto fd = pidfd_open(pid);
+        if(fd == -1) throw posix::errno_error();
+
+        try { queue(fd, &entry::reads, op { std::move(fn), nullptr, 0, true }); }
+        catch(...) { ::close(fd); throw; }
+    }
+
+    std::size_t run_once(std::chrono::milliseconds) override;
+
+    std::size_t pending() const noexcept override { return pending_; }
+
+private:
+    ////////////////////
+    struct op
+    {
+        io_engine::handler fn;
+        char* data;
+        std::size_t size;
+        bool exit = false;
+    };
+
+    struct entry
+    {
+        std::deque<op> reads, writes;
+        std::uint32_t events = 0; // registered with epoll
+    };
+
+    int epoll_;
+    std::unordered_map<int, entry> fds_;
+    std::size_t pending_ = 0;
+
+    void queue(int fd, std::deque<op> entry::*, op&&);
+    void update(int fd);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+void epoll_backend::queue(int fd, std::deque<op> entry::* ops, op&& o)
+{
+    auto& e = fds_[fd];
+    (e.*ops).push_back(std::move(o));
+    try { update(fd); }
+    catch(...)
+    {
+        (e.*ops).pop_back();
+        if(e.reads.empty() && e.writes.empty()) fds_.erase(fd);
+        throw;
+    }
+    ++pending_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void epoll_backend::update(int fd)
+{
+    auto it = fds_.find(fd);
+    if(it == fds_.end()) return;
+
+    auto& e = it->second;
+    std::uint32_t events = (e.reads.size() ? std::uint32_t(EPOLLIN) : 0) | (e.writes.size() ? std::uint32_t(EPOLLOUT) : 0);
+    if(events == e.events) return;
+
+    epoll_event ev { events, { } };
+    ev.data.fd = fd;
+
+    // closed pidfds are already gone from epoll, hence no check for DEL
+    int ctl = !e.events ? EPOLL_CTL_ADD : events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    if(::epoll_ctl(epoll_, ctl, fd, &ev) && ctl != EPOLL_CTL_DEL) throw posix::errno_error();
+
+    if(events) e.events = events;
+    else fds_.erase(it);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t epoll_backend::run_once(std::chrono::milliseconds timeout)
+{
+    if(!pending_) return 0;
+
+    epoll_event events[64];
+    auto n = ::epoll_wait(epoll_, events, 64, timeout.count() < 0 ? -1 : static_cast<int>(timeout.count()));
+    if(n == -1)
+    {
+        if(errno == EINTR) return 0;
+        throw posix::errno_error();
+    }
+
+    ////////////////////
+    std::vector<std::pair<io_engine::handler, int>> done;
+    for(auto i = 0; i < n; ++i)
+    {
+        auto fd = events[i].data.fd;
+        auto it = fds_.find(fd);
+        if(it == fds_.end()) continue;
+        auto& e = it->second;
+
+        // pipe is either ready or closed on the other end (HUP/ERR),
+        // in which case read or write doesn't block either
+        if(e.reads.size() && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+        {
+            auto o = std::move(e.reads.front());
+            e.reads.pop_front();
+
+            int result = 0;
+            if(o.exit) ::close(fd);
+            else
+            {
+                ssize_t c;
+                do c = ::read(fd, o.data, o.size);
+                while(c == -1 && errno == EINTR);
+                result = c == -1 ? -errno : static_cast<int>(c);
+            }
+            done.emplace_back(std::move(o.fn), result);
+        }
+
+        if(e.writes.size() && (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)))
+        {
+            auto o = std::move(e.writes.front());
+            e.writes.pop_front();
+
+            // fits into free space of the pipe, which is writable
+            ssize_t c;
+            do c = ::write(fd, o.data, std::min<std::size_t>(o.size, PIPE_BUF));
+            while(c == -1 && errno == EINTR);
+
+            done.emplace_back(std::move(o.fn), c == -1 ? -errno : static_cast<int>(c));
+        }
+
+        update(fd);
+    }
+    pending_ -= done.size();
+
+    return complete(done);
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+io_engine::io_engine(unsigned entries, bool uring) :
+    backend_(uring ? uring_backend::create(entries) : nullptr)
+{
+    if(!backend_) backend_.reset(new epoll_backend());
+}
+
+io_engine::~io_engine() { }
+
+bool io_engine::uring() const noexcept { return backend_->uring(); }
+
+////////////////////////////////////////////////////////////////////////////////
+void io_engine::read(int fd, void* data, std::size_t size, handler fn)
+{ backend_->read(fd, data, size, std::move(fn)); }
+
+void io_engine::write(int fd, const void* data, std::size_t size, handler fn)
+{ backend_->write(fd, data, size, std::move(fn)); }
+
+void io_engine::wait_exit(const process& p, handler fn)
+{
+    if(!p.joinable()) throw std::system_error(posix::errc::invalid_argument);
+    backend_->wait_exit(p.native_handle(), std::move(fn));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t io_engine::run_once(std::chrono::milliseconds timeout)
+{ return backend_->run_once(timeout); }
+
+std::size_t io_engine::pending() const noexcept { return backend_->pending(); }
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_IO_ENGINE_HPP
+#define PGM_IO_ENGINE_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/process.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Completion-based I/O on process pipes and exit waits.
+//
+// Uses io_uring when the kernel supports it (Linux 5.19+): operations are
+// queued in the submission ring and submitted all at once by run_once(),
+// which also waits for and collects completions in the same system call.
+// Exit waits use IORING_OP_WAITID (Linux 6.7+) or a poll on a pidfd.
+//
+// Falls back to epoll on older kernels or when io_uring is disabled.
+// Reads and writes are then made once their fds become ready, and
+// writes are limited to PIPE_BUF bytes so that they don't block.
+//
+// Not thread-safe: operations are queued and handlers are called
+// on the thread which calls run_once().
+//
+class io_engine
+{
+public:
+    ////////////////////
+    // result is number of bytes transferred (0 on exit) or -errno
+    using handler = std::function<void(int result)>;
+
+    // use io_uring with up to this many entries, unless uring is false
+    // (eg, to compare the two)
+    explicit io_engine(unsigned entries = 256, bool uring = true);
+    ~io_engine();
+
+    io_engine(const io_engine&) = delete;
+    io_engine& operator=(const io_engine&) = delete;
+
+    // check if using io_uring
+    bool uring() const noexcept;
+
+    ////////////////////
+    // queue read from or write to fd (eg, process::fd()), which should
+    // not be in non-blocking mode; the buffer must stay valid until
+    // handler is called; short reads and writes are possible
+    void read(int fd, void* data, std::size_t size, handler);
+    void write(int fd, const void* data, std::size_t size, handler);
+
+    // queue wait for process to exit; it's not reaped,
+    // so that process::join() can be called without blocking afterwards
+    void wait_exit(const process&, handler);
+
+    ////////////////////
+    // submit queued operations, wait for at least one of them to complete
+    // (up to timeout, if not negative) and call handlers of completed ones
+    // returns number of handlers called
+    std::size_t run_once(std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+
+    // run until no operations are left
+    void run() { while(pending()) run_once(); }
+
+    // get number of operations queued or in flight
+    std::size_t pending() const noexcept;
+
+    ////////////////////
+    struct backend;
+
+private:
+    ////////////////////
+    std::unique_ptr<backend> backend_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
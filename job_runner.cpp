@@ -0,0 +1,323 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "posix/error.hpp"
+#include "proc/charpp.hpp"
+#include "proc/drain.hpp"
+#include "proc/job_runner.hpp"
+#include "proc/jobserver.hpp"
+#include "proc/reactor.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Running job (only touched on the reactor thread).
+//
+struct job_runner::job
+{
+    process proc;
+    result res;
+    std::shared_ptr<void> token; // jobserver token
+    std::chrono::steady_clock::time_point start;
+
+    int open = 0; // pipes not at EOF yet
+    bool exited = false;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// State shared with the reactor.
+//
+struct job_runner::state : std::enable_shared_from_this<job_runner::state>
+{
+    ////////////////////
+    std::size_t jobs;
+    spawn_options options;
+    callback done;
+
+    // tokens are acquired by us rather than the process
+    pgm::jobserver* js = nullptr;
+    int js_fd = -1; // own fd to watch with the reactor
+    bool waiting = false; // for token
+
+    ~state() { if(js_fd != -1) ::close(js_fd); }
+
+    mutable std::mutex mutex;
+    std::condition_variable finished;
+
+    std::deque<std::pair<std::size_t, function>> queue;
+    std::size_t next_id = 0;
+    std::size_t running = 0; // started and not exited
+    std::size_t active = 0;  // started and not finished
+
+    std::vector<result> results;
+
+    ////////////////////
+    void start();
+    void launch(std::size_t id, function, std::shared_ptr<void> token);
+
+    void drain(const std::shared_ptr<job>&, int fd, std::string& to);
+    void on_exit(const std::shared_ptr<job>&, const exit_status&);
+    void finish(result&&);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+void job_runner::state::start()
+{
+    for(;;)
+    {
+        std::pair<std::size_t, function> next;
+        std::shared_ptr<void> token;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(running >= jobs || queue.empty()) return;
+
+            // try even if we are waiting for the pipe, as giving back
+            // the implicit token (eg, when a job exits) doesn't make it
+            // readable, so we would never wake up in that case
+            if(js)
+            {
+                if(!(token = js->try_acquire()))
+                {
+                    if(waiting) return;
+
+                    // try again once there is a token in the pipe
+                    auto self = shared_from_this();
+                    reactor::instance().add(js_fd, EPOLLIN, [self](std::uint32_t)
+                    {
+                        reactor::instance().remove(self->js_fd);
+                        {
+                            std::lock_guard<std::mutex> lock(self->mutex);
+                            self->waiting = false;
+                        }
+                        self->start();
+                    });
+                    waiting = true;
+                    return;
+                }
+                if(waiting)
+                {
+                    reactor::instance().remove(js_fd);
+                    waiting = false;
+                }
+            }
+
+            next = std::move(queue.front());
+            queue.pop_front();
+            ++running;
+        }
+        launch(next.first, std::move(next.second), std::move(token));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void job_runner::state::launch(std::size_t id, function fn, std::shared_ptr<void> token)
+{
+    auto j = std::make_shared<job>();
+    j->res.id = id;
+    j->token = std::move(token);
+    j->start = std::chrono::steady_clock::now();
+
+    try
+    {
+        j->proc = process(options, [&]()
+        {
+            // jobs don't get stdin, unless it's redirected from file
+            if(options.in.path.empty())
+            {
+                auto null = ::open("/dev/null", O_RDONLY);
+                if(null != -1) { ::dup2(null, STDIN_FILENO); ::close(null); }
+            }
+
+            if(js) js->inherit();
+            return fn();
+        });
+
+        auto self = shared_from_this();
+        j->proc.then([self, j](const exit_status& status){ self->on_exit(j, status); });
+    }
+    catch(std::exception& e)
+    {
+        if(j->proc.joinable()) { j->proc.kill(); j->proc.join(); }
+        j->token.reset();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --running;
+        }
+        j->res.err = e.what();
+        return finish(std::move(j->res));
+    }
+
+    auto self = shared_from_this();
+    auto& re = reactor::instance();
+
+    for(auto stream : { &j->proc.cout, &j->proc.cerr })
+    {
+        auto fd = j->proc.fd(*stream);
+        if(fd == -1) continue; // redirected to file
+
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        auto& to = stream == &j->proc.cout ? j->res.out : j->res.err;
+        re.add(fd, EPOLLIN, [self, j, fd, &to](std::uint32_t){ self->drain(j, fd, to); });
+        ++j->open;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void job_runner::state::drain(const std::shared_ptr<job>& j, int fd, std::string& to)
+{
+    if(pgm::drain(fd, to) == -1 && errno == EAGAIN) return;
+
+    // EOF or error
+    reactor::instance().remove(fd);
+    if(!--j->open && j->exited) finish(std::move(j->res));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void job_runner::state::on_exit(const std::shared_ptr<job>& j, const exit_status& status)
+{
+    j->res.status = status;
+    j->res.time = std::chrono::steady_clock::now() - j->start;
+    j->exited = true;
+
+    // already reaped, so this doesn't block
+    j->proc.join();
+    j->token.reset();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        --running;
+    }
+    start();
+
+    if(!j->open) finish(std::move(j->res));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void job_runner::state::finish(result&& res)
+{
+    if(done) try { done(std::move(res)); } catch(...) { }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!done) results.push_back(std::move(res));
+
+    --active;
+    if(!active) finished.notify_all();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+job_runner::job_runner(std::size_t jobs, spawn_options options, callback done) :
+    state_(std::make_shared<state>())
+{
+    if(!jobs) throw std::system_error(posix::errc::invalid_argument);
+
+    state_->jobs = jobs;
+    state_->options = std::move(options);
+    state_->done = std::move(done);
+
+    if((state_->js = state_->options.jobserver))
+    {
+        state_->options.jobserver = nullptr;
+
+        state_->js_fd = ::fcntl(state_->js->fd(), F_DUPFD_CLOEXEC, 0);
+        if(state_->js_fd == -1) throw posix::errno_error();
+
+        // we pass the pipe on ourselves, so keep it open in jobs
+        if(state_->options.fds.size())
+        {
+            auto pipe = state_->js->pipe();
+            for(auto fd : { pipe.first, pipe.second })
+                if(fd != -1) state_->options.fds.emplace_back(fd, fd);
+        }
+    }
+}
+
+job_runner::~job_runner()
+{
+    try { wait(); } catch(...) { }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t job_runner::add(command cmd)
+{
+    if(cmd.empty()) throw std::system_error(posix::errc::invalid_argument);
+
+    return add([cmd = std::move(cmd)]()
+    {
+        auto args = make_charpp(cmd.begin(), cmd.end());
+        ::execvp(args[0], args.get());
+        return 127; // like the shell
+    });
+}
+
+std::size_t job_runner::add(function fn)
+{
+    std::size_t id;
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        id = state_->next_id++;
+
+        state_->queue.emplace_back(id, std::move(fn));
+        ++state_->active;
+    }
+
+    // jobs are started on the reactor thread
+    auto& re = reactor::instance();
+    if(re.this_thread()) state_->start();
+    else re.post([self = state_]{ self->start(); });
+
+    return id;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<job_runner::result> job_runner::wait()
+{
+    if(reactor::instance().this_thread())
+        throw std::system_error(posix::errc::resource_deadlock_would_occur);
+
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->finished.wait(lock, [&]{ return !state_->active; });
+
+    auto results = std::move(state_->results);
+    state_->results.clear();
+    lock.unlock();
+
+    std::sort(results.begin(), results.end(),
+        [](const result& x, const result& y){ return x.id < y.id; }
+    );
+    return results;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t job_runner::running() const
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->running;
+}
+
+std::size_t job_runner::pending() const
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->queue.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,88 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_JOB_RUNNER_HPP
+#define PGM_JOB_RUNNER_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/process.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Runs queued jobs with at most N of them at a time (like make -j).
+//
+// Jobs are started and finished on the reactor thread: the next job is
+// started as soon as a running one exits, and stdout and stderr of each
+// job are collected as they come in. Jobs get /dev/null as their stdin.
+//
+// Results are either passed to the callback given to the constructor
+// (on the reactor thread) or collected and returned by wait().
+//
+// With spawn_options::jobserver, each job also needs a token from the
+// jobserver to start. Tokens are acquired without blocking the reactor.
+//
+class job_runner
+{
+public:
+    ////////////////////
+    using command = std::vector<std::string>; // run with execvp(3)
+    using function = std::function<int()>;    // run in child process
+
+    struct result
+    {
+        std::size_t id;     // order in which job was added
+        exit_status status; // not_started if the job could not be started
+        std::string out, err;
+        std::chrono::nanoseconds time { }; // from start to finish
+    };
+    using callback = std::function<void(result&&)>;
+
+    ////////////////////
+    explicit job_runner(std::size_t jobs, spawn_options = { }, callback = { });
+    ~job_runner();
+
+    job_runner(const job_runner&) = delete;
+    job_runner& operator=(const job_runner&) = delete;
+
+    ////////////////////
+    // queue job and return its id
+    std::size_t add(command);
+    std::size_t add(function);
+
+    // wait for all queued jobs to finish and return their
+    // results ordered by id (empty if callback was given)
+    //
+    // Throws std::system_error with errc::resource_deadlock_would_occur
+    // if called from the reactor thread.
+    std::vector<result> wait();
+
+    // get number of running and queued jobs
+    std::size_t running() const;
+    std::size_t pending() const;
+
+private:
+    ////////////////////
+    struct job;
+    struct state;
+    std::shared_ptr<state> state_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
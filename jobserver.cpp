@@ -0,0 +1,247 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "posix/error.hpp"
+#include "proc/jobserver.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+// open new file description of pipe fd, so that we can make it
+// non-blocking without affecting other processes sharing the pipe
+int reopen(int fd, int flags)
+{
+    auto path = "/proc/self/fd/" + std::to_string(fd);
+    return ::open(path.data(), flags | O_CLOEXEC);
+}
+
+void close(int& fd) noexcept { if(fd != -1) { ::close(fd); fd = -1; } }
+
+// get value of option in MAKEFLAGS (the last one wins)
+std::string option(const std::string& flags, const std::string& name)
+{
+    std::string value;
+
+    std::istringstream is(flags);
+    for(std::string word; is >> word; )
+        if(word.compare(0, name.size(), name) == 0) value = word.substr(name.size());
+
+    return value;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::unique_ptr<jobserver> jobserver::from_env()
+{
+    auto env = std::getenv("MAKEFLAGS");
+    if(!env) return nullptr;
+
+    std::string flags = env;
+
+    auto auth = option(flags, "--jobserver-auth=");
+    if(auth.empty()) auth = option(flags, "--jobserver-fds="); // make < 4.2
+    if(auth.empty()) return nullptr;
+
+    std::unique_ptr<jobserver> js(new jobserver());
+    if(auth.compare(0, 5, "fifo:") == 0)
+    {
+        auto path = auth.substr(5);
+        js->read_ = ::open(path.data(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        js->write_ = ::open(path.data(), O_WRONLY | O_CLOEXEC);
+    }
+    else
+    {
+        int r, w;
+        if(std::sscanf(auth.data(), "%d,%d", &r, &w) != 2) return nullptr;
+
+        // make only passes the pipe to recursive commands (marked with +)
+        if(::fcntl(r, F_GETFD) == -1 || ::fcntl(w, F_GETFD) == -1) return nullptr;
+
+        js->read_ = reopen(r, O_RDONLY | O_NONBLOCK);
+        js->write_ = ::fcntl(w, F_DUPFD_CLOEXEC, 0);
+
+        // children inherit them from us
+        js->pass_read_ = r;
+        js->pass_write_ = w;
+        js->own_pass_ = false;
+    }
+    if(js->read_ == -1 || js->write_ == -1) return nullptr;
+
+    auto jobs = option(flags, "-j");
+    if(jobs.size()) js->jobs_ = std::strtoul(jobs.data(), nullptr, 10);
+
+    js->event_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(js->event_ == -1) throw posix::errno_error();
+
+    // children inherit MAKEFLAGS and the pipe from us
+    js->makeflags_ = std::move(flags);
+    return js;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+jobserver::jobserver(std::size_t jobs, std::string fifo) : jobs_(jobs)
+{
+    if(!jobs) throw std::system_error(posix::errc::invalid_argument);
+
+    try
+    {
+        std::string auth;
+        if(fifo.size())
+        {
+            if(::mkfifo(fifo.data(), 0600)) throw posix::errno_error();
+            fifo_ = fifo;
+
+            read_ = ::open(fifo.data(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            if(read_ == -1) throw posix::errno_error();
+
+            write_ = ::open(fifo.data(), O_WRONLY | O_CLOEXEC);
+            if(write_ == -1) throw posix::errno_error();
+
+            auth = "fifo:" + fifo;
+        }
+        else
+        {
+            int fds[2];
+            if(::pipe2(fds, O_CLOEXEC)) throw posix::errno_error();
+            pass_read_ = fds[0];
+            pass_write_ = fds[1];
+
+            // no procfs: make the shared one non-blocking
+            read_ = reopen(pass_read_, O_RDONLY | O_NONBLOCK);
+            if(read_ == -1)
+            {
+                read_ = ::fcntl(pass_read_, F_DUPFD_CLOEXEC, 0);
+                if(read_ == -1) throw posix::errno_error();
+                ::fcntl(read_, F_SETFL, O_NONBLOCK);
+            }
+            write_ = ::fcntl(pass_write_, F_DUPFD_CLOEXEC, 0);
+            if(write_ == -1) throw posix::errno_error();
+
+            auth = std::to_string(pass_read_) + "," + std::to_string(pass_write_);
+        }
+
+        // one token is implicit
+        for(std::size_t n = 1; n < jobs; ++n)
+            if(::write(write_, "+", 1) != 1) throw posix::errno_error();
+
+        event_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if(event_ == -1) throw posix::errno_error();
+
+        makeflags_ = "-j" + std::to_string(jobs) + " --jobserver-auth=" + auth;
+    }
+    catch(...)
+    {
+        reset();
+        throw;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+jobserver::~jobserver() { reset(); }
+
+void jobserver::reset() noexcept
+{
+    close(read_);
+    close(write_);
+    if(own_pass_)
+    {
+        close(pass_read_);
+        close(pass_write_);
+    }
+    close(event_);
+
+    if(fifo_.size()) { ::unlink(fifo_.data()); fifo_.clear(); }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::shared_ptr<void> jobserver::try_acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(implicit_) { implicit_ = false; return lease(true); }
+    }
+
+    for(;;)
+    {
+        char token;
+        auto n = ::read(read_, &token, 1);
+        if(n == 1) return lease(false, token);
+
+        if(n == -1 && errno == EINTR) continue;
+        if(n == -1 && errno == EAGAIN) return nullptr;
+
+        // writers are gone
+        if(n == 0) throw std::system_error(posix::errc::broken_pipe);
+        throw posix::errno_error();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::shared_ptr<void> jobserver::acquire()
+{
+    for(;;)
+    {
+        if(auto lease = try_acquire()) return lease;
+
+        // wait for token in the pipe or the implicit one
+        pollfd fds[] = { { read_, POLLIN, 0 }, { event_, POLLIN, 0 } };
+        if(::poll(fds, 2, -1) == -1 && errno != EINTR) throw posix::errno_error();
+
+        std::uint64_t count;
+        if(fds[1].revents) ::read(event_, &count, sizeof(count));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::shared_ptr<void> jobserver::lease(bool implicit, char token)
+{
+    // non-null, so that it can be checked
+    return std::shared_ptr<void>(this, [this, implicit, token](void*)
+    {
+        if(implicit)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            implicit_ = true;
+
+            std::uint64_t one = 1;
+            ::write(event_, &one, sizeof(one));
+        }
+        // give back the same token we got
+        else while(::write(write_, &token, 1) == -1 && errno == EINTR);
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void jobserver::inherit() const noexcept
+{
+    if(pass_read_ != -1) ::fcntl(pass_read_, F_SETFD, 0);
+    if(pass_write_ != -1) ::fcntl(pass_write_, F_SETFD, 0);
+
+    ::setenv("MAKEFLAGS", makeflags_.data(), true);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,109 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_JOBSERVER_HPP
+#define PGM_JOBSERVER_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// GNU make jobserver.
+//
+// Limits the number of jobs running at the same time across cooperating
+// processes (make, nested tools and their children). Each job holds
+// a token, which is a byte read from a shared pipe or fifo and written
+// back when the job finishes. Every participant also has one implicit
+// token, which it doesn't need to read.
+//
+// Can either connect to the jobserver of a parent make (client) or
+// create a new one (server). In both cases, children started with this
+// jobserver in their spawn_options hold a token while they run and get
+// MAKEFLAGS, which lets them join in.
+//
+class jobserver
+{
+public:
+    ////////////////////
+    // connect to jobserver of parent make described in MAKEFLAGS
+    // (--jobserver-auth=fifo:PATH or --jobserver-auth=R,W)
+    // returns nullptr if there is none or it's not usable
+    static std::unique_ptr<jobserver> from_env();
+
+    // create jobserver with this many tokens (counting the implicit one);
+    // uses a fifo at path (make 4.4+) or an anonymous pipe if path is empty
+    explicit jobserver(std::size_t jobs, std::string fifo = { });
+    ~jobserver();
+
+    jobserver(const jobserver&) = delete;
+    jobserver& operator=(const jobserver&) = delete;
+
+    ////////////////////
+    // acquire token and return a lease, which gives it back when
+    // destroyed; the jobserver must outlive the lease
+    std::shared_ptr<void> acquire();
+
+    // same as above, but returns nullptr if no token is available
+    std::shared_ptr<void> try_acquire();
+
+    // get file descriptor, which becomes readable when tokens may be
+    // available in the pipe (eg, to watch it with the reactor);
+    // giving back the implicit token doesn't make it readable
+    int fd() const noexcept { return read_; }
+
+    // get number of tokens (0 if unknown)
+    std::size_t jobs() const noexcept { return jobs_; }
+
+    // get pipe file descriptors inherited by children: { read, write }
+    // or { -1, -1 } if a fifo is used
+    std::pair<int, int> pipe() const noexcept { return { pass_read_, pass_write_ }; }
+
+    ////////////////////
+    // get MAKEFLAGS value for children
+    const std::string& makeflags() const noexcept { return makeflags_; }
+
+    // let children of calling process use this jobserver:
+    // sets MAKEFLAGS and makes pipe inheritable, if needed;
+    // to be called in the child between fork and exec
+    void inherit() const noexcept;
+
+private:
+    ////////////////////
+    jobserver() = default;
+
+    int read_ = -1, write_ = -1; // own file descriptions
+
+    // pipe file descriptors passed to children
+    // (server or client of make which passed them to us)
+    int pass_read_ = -1, pass_write_ = -1;
+    bool own_pass_ = true; // false if they came from make
+
+    std::string fifo_; // path, if we created it
+    std::size_t jobs_ = 0;
+    std::string makeflags_;
+
+    std::mutex mutex_;
+    bool implicit_ = true; // implicit token available
+    int event_ = -1;       // signalled when it is given back
+
+    std::shared_ptr<void> lease(bool implicit, char token = 0);
+    void reset() noexcept;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
@@ -0,0 +1,240 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/metrics.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+namespace metrics
+{
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+constexpr std::size_t histograms = reap_latency + 1;
+
+// bucket 0 is up to 2^min_exp ns, followed by sub buckets per power
+// of two up to 2^max_exp ns, and the last one is for everything above
+constexpr int min_exp = 10, max_exp = 40, sub_bits = 2;
+constexpr std::size_t subs = 1 << sub_bits;
+constexpr std::size_t buckets = 1 + (max_exp - min_exp) * subs + 1;
+
+constexpr std::size_t errors = 256, signals = 65;
+
+std::size_t bucket(std::uint64_t ns) noexcept
+{
+    if(ns < (std::uint64_t(1) << min_exp)) return 0;
+
+    int exp = 63 - __builtin_clzll(ns);
+    if(exp >= max_exp) return buckets - 1;
+
+    auto sub = (ns >> (exp - sub_bits)) & (subs - 1);
+    return 1 + (exp - min_exp) * subs + sub;
+}
+
+// upper bound of bucket in ns
+std::uint64_t bound(std::size_t i) noexcept
+{
+    if(i == 0) return std::uint64_t(1) << min_exp;
+
+    auto exp = min_exp + (i - 1) / subs;
+    auto sub = (i - 1) % subs;
+    return (subs + sub + 1) << (exp - sub_bits);
+}
+
+////////////////////
+using counter = std::atomic<std::uint64_t>;
+
+// single writer, so no need for fetch_add
+void add(counter& c, std::uint64_t n = 1) noexcept
+{ c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+
+std::uint64_t get(const counter& c) noexcept { return c.load(std::memory_order_relaxed); }
+
+// set of counters updated by one thread
+struct shard
+{
+    counter counts[histograms][buckets] { };
+    counter sums[histograms] { }; // ns
+
+    counter spawns { 0 }, finished { 0 };
+    counter failures[errors] { };
+    counter signals[metrics::signals] { };
+
+    void merge(const shard& s) noexcept
+    {
+        for(std::size_t h = 0; h < histograms; ++h)
+        {
+            for(std::size_t i = 0; i < buckets; ++i) add(counts[h][i], get(s.counts[h][i]));
+            add(sums[h], get(s.sums[h]));
+        }
+        add(spawns, get(s.spawns));
+        add(finished, get(s.finished));
+        for(std::size_t i = 0; i < errors; ++i) add(failures[i], get(s.failures[i]));
+        for(std::size_t i = 0; i < metrics::signals; ++i) add(signals[i], get(s.signals[i]));
+    }
+};
+
+////////////////////
+struct registry
+{
+    std::mutex mutex;
+    std::vector<shard*> shards;
+    shard retired; // of threads that exited
+};
+
+// never destroyed, as threads may exit after static destruction
+registry& global()
+{
+    static auto r = new registry();
+    return *r;
+}
+
+struct local
+{
+    shard s;
+
+    local()
+    {
+        auto& r = global();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.shards.push_back(&s);
+    }
+    ~local()
+    {
+        auto& r = global();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.retired.merge(s);
+        r.shards.erase(std::find(r.shards.begin(), r.shards.end(), &s));
+    }
+};
+
+shard& this_shard()
+{
+    thread_local local l;
+    return l.s;
+}
+
+////////////////////
+struct info { const char* name; const char* help; };
+
+const info names[histograms] =
+{
+    { "pgm_spawn_latency_seconds", "Time to start process." },
+    { "pgm_first_output_seconds", "Time from start of process until first byte of output." },
+    { "pgm_lifetime_seconds", "Time from start of process until its exit." },
+    { "pgm_reap_latency_seconds", "Time from exit of process until its status is published." },
+};
+
+void append(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+void append(std::string& out, const char* fmt, ...)
+{
+    char buffer[256];
+
+    va_list args;
+    va_start(args, fmt);
+    auto n = std::vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+
+    if(n > 0) out.append(buffer, std::min<std::size_t>(n, sizeof(buffer) - 1));
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void observe(histogram h, std::chrono::nanoseconds time)
+{
+    auto ns = static_cast<std::uint64_t>(std::max<std::int64_t>(time.count(), 0));
+
+    auto& s = this_shard();
+    add(s.counts[h][bucket(ns)]);
+    add(s.sums[h], ns);
+}
+
+void spawned() { add(this_shard().spawns); }
+void finished() { add(this_shard().finished); }
+
+void spawn_failed(int error)
+{
+    if(error >= 0 && static_cast<std::size_t>(error) < errors) add(this_shard().failures[error]);
+}
+
+void signaled(int signal)
+{
+    if(signal > 0 && static_cast<std::size_t>(signal) < signals) add(this_shard().signals[signal]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::string scrape()
+{
+    shard total;
+    {
+        auto& r = global();
+        std::lock_guard<std::mutex> lock(r.mutex);
+
+        total.merge(r.retired);
+        for(auto s : r.shards) total.merge(*s);
+    }
+
+    std::string out;
+    for(std::size_t h = 0; h < histograms; ++h)
+    {
+        auto name = names[h].name;
+        append(out, "# HELP %s %s\n# TYPE %s histogram\n", name, names[h].help, name);
+
+        std::uint64_t count = 0;
+        for(std::size_t i = 0; i < buckets - 1; ++i)
+        {
+            count += get(total.counts[h][i]);
+            append(out, "%s_bucket{le=\"%.9g\"} %llu\n", name, bound(i) * 1e-9, (unsigned long long)count);
+        }
+        count += get(total.counts[h][buckets - 1]);
+
+        append(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)count);
+        append(out, "%s_sum %.9g\n", name, get(total.sums[h]) * 1e-9);
+        append(out, "%s_count %llu\n", name, (unsigned long long)count);
+    }
+
+    auto spawns = get(total.spawns), finished = get(total.finished);
+
+    out += "# HELP pgm_spawns_total Processes started.\n# TYPE pgm_spawns_total counter\n";
+    append(out, "pgm_spawns_total %llu\n", (unsigned long long)spawns);
+
+    out += "# HELP pgm_spawn_failures_total Processes which failed to start by errno.\n"
+           "# TYPE pgm_spawn_failures_total counter\n";
+    for(std::size_t i = 0; i < errors; ++i)
+        if(auto n = get(total.failures[i]))
+            append(out, "pgm_spawn_failures_total{errno=\"%zu\"} %llu\n", i, (unsigned long long)n);
+
+    out += "# HELP pgm_signals_total Processes killed by signal.\n# TYPE pgm_signals_total counter\n";
+    for(std::size_t i = 0; i < signals; ++i)
+        if(auto n = get(total.signals[i]))
+            append(out, "pgm_signals_total{signal=\"%zu\"} %llu\n", i, (unsigned long long)n);
+
+    // finished may briefly run ahead of spawned on another thread
+    out += "# HELP pgm_children Processes started and not finished yet.\n# TYPE pgm_children gauge\n";
+    append(out, "pgm_children %llu\n", (unsigned long long)(spawns > finished ? spawns - finished : 0));
+
+    return out;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
+}
@@ -0,0 +1,60 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_METRICS_HPP
+#define PGM_METRICS_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include <chrono>
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Metrics of the library itself.
+//
+// Each thread updates its own set of counters without locking or atomic
+// read-modify-write operations. They are summed up when scraped (and
+// folded into a global set when the thread exits).
+//
+// Latencies are kept in log-bucketed histograms with 4 buckets per
+// power of two from 1us to about 18 minutes.
+//
+namespace metrics
+{
+
+////////////////////
+enum histogram
+{
+    spawn_latency, // from start of process constructor until it returns
+    first_output,  // from start of process until first byte read through cout
+    lifetime,      // from start of process until its exit is noticed
+    reap_latency,  // from exit being noticed by the reaper until it's published
+                   // (including continuations, see process::then())
+};
+
+void observe(histogram, std::chrono::nanoseconds);
+
+////////////////////
+void spawned();               // process started
+void spawn_failed(int error); // process constructor failed with errno
+void finished();              // process exited or was killed
+void signaled(int signal);    // process was killed by signal
+
+////////////////////
+// get all metrics in Prometheus text exposition format
+std::string scrape();
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
@@ -0,0 +1,148 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "posix/error.hpp"
+#include "proc/placement.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <system_error>
+
+#include <sched.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<int> parse_list(const std::string& list)
+{
+    std::vector<int> values;
+
+    std::istringstream is(list);
+    for(std::string range; std::getline(is, range, ','); )
+    {
+        if(range.find_first_not_of(" \n") == std::string::npos) continue;
+
+        auto dash = range.find('-');
+        auto first = std::stoi(range.substr(0, dash));
+        auto last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+
+        for(auto n = first; n <= last; ++n) values.push_back(n);
+    }
+    return values;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+std::string read_file(const std::string& path)
+{
+    std::ifstream ifs(path);
+    return std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+placement::placement(policy p, std::size_t cpus) : policy_(p), count_(cpus)
+{
+    cpu_set_t allowed;
+    if(::sched_getaffinity(0, sizeof(allowed), &allowed)) throw posix::errno_error();
+
+    auto online = read_file("/sys/devices/system/node/online");
+    for(auto id : parse_list(online))
+    {
+        node n { id, { } };
+        for(auto cpu : parse_list(read_file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist")))
+            if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) n.cpus.push_back(cpu);
+
+        if(n.cpus.size()) nodes_.push_back(std::move(n));
+    }
+
+    // no NUMA support: one node with all CPUs
+    if(nodes_.empty())
+    {
+        node n { 0, { } };
+        for(auto cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if(CPU_ISSET(cpu, &allowed)) n.cpus.push_back(cpu);
+        nodes_.push_back(std::move(n));
+    }
+
+    for(auto& n : nodes_) max_cpu_ = std::max(max_cpu_, n.cpus.back());
+    load_.resize(max_cpu_ + 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t placement::load(int cpu) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cpu >= 0 && cpu <= max_cpu_ ? load_[cpu] : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t placement::node_load(const node& n) const noexcept
+{
+    std::size_t load = 0;
+    for(auto cpu : n.cpus) load += load_[cpu];
+    return load;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::shared_ptr<void> placement::acquire(slot& s)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // compare nodes by load per cpu
+    auto less = [&](const node& x, const node& y)
+    { return node_load(x) * y.cpus.size() < node_load(y) * x.cpus.size(); };
+
+    const node* n = nullptr;
+    if(policy_ == pack)
+    {
+        // first node that has room for us
+        for(auto& each : nodes_)
+        {
+            auto need = count_ ? count_ : each.cpus.size();
+            if(node_load(each) + need <= each.cpus.size()) { n = &each; break; }
+        }
+    }
+    if(!n) n = &*std::min_element(nodes_.begin(), nodes_.end(), less);
+
+    s.node = n->id;
+    s.bind = !count_;
+    if(count_)
+    {
+        // least loaded CPUs of the node
+        auto cpus = n->cpus;
+        std::stable_sort(cpus.begin(), cpus.end(),
+            [&](int x, int y){ return load_[x] < load_[y]; }
+        );
+        cpus.resize(std::min(count_, cpus.size()));
+        std::sort(cpus.begin(), cpus.end());
+        s.cpus = std::move(cpus);
+    }
+    else s.cpus = n->cpus;
+
+    for(auto cpu : s.cpus) ++load_[cpu];
+
+    auto cpus = s.cpus;
+    return std::shared_ptr<void>(nullptr, [this, cpus](void*){ release(cpus); });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void placement::release(const std::vector<int>& cpus) noexcept
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(auto cpu : cpus) if(load_[cpu]) --load_[cpu];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,95 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_PLACEMENT_HPP
+#define PGM_PLACEMENT_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// CPU/NUMA placement policy for processes.
+//
+// Assigns CPUs (and the NUMA node they belong to) to successive processes
+// started with this placement in their spawn_options, keeping track of
+// how many live processes occupy each CPU.
+//
+// spread: distribute processes across NUMA nodes and CPUs;
+// pack:   fill up one node (one process per CPU) before moving to the next.
+//
+// When assigning whole nodes, processes can run on any CPU of the node
+// and their memory is bound to it. Otherwise, memory is allocated
+// preferably from the node of the assigned CPUs.
+//
+class placement
+{
+public:
+    ////////////////////
+    enum policy { spread, pack };
+
+    // assign this many CPUs per process (0 = whole node)
+    explicit placement(policy, std::size_t cpus = 1);
+
+    placement(const placement&) = delete;
+    placement& operator=(const placement&) = delete;
+
+    ////////////////////
+    struct node
+    {
+        int id;
+        std::vector<int> cpus;
+    };
+    // get NUMA topology (limited to CPUs we are allowed to run on)
+    const std::vector<node>& nodes() const noexcept { return nodes_; }
+
+    // get number of live processes on cpu
+    std::size_t load(int cpu) const;
+
+    ////////////////////
+    struct slot
+    {
+        int node;
+        std::vector<int> cpus;
+        bool bind; // bind memory to node
+    };
+
+    // assign slot to next process; the slot is occupied
+    // until the returned lease is destroyed
+    std::shared_ptr<void> acquire(slot&);
+
+private:
+    ////////////////////
+    policy policy_;
+    std::size_t count_;
+
+    std::vector<node> nodes_;
+    int max_cpu_ = 0;
+
+    mutable std::mutex mutex_;
+    std::vector<std::size_t> load_; // indexed by cpu
+
+    std::size_t node_load(const node&) const noexcept;
+    void release(const std::vector<int>& cpus) noexcept;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// parse cpu or node list (eg, "0-3,8-11")
+std::vector<int> parse_list(const std::string&);
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
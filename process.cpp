@@ -6,14 +6,49 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 #include "posix/error.hpp"
+#include "proc/cgroup.hpp"
+#include "proc/control.hpp"
+#include "proc/framing.hpp"
+#include "proc/group.hpp"
+#include "proc/jobserver.hpp"
+#include "proc/metrics.hpp"
+#include "proc/placement.hpp"
 #include "proc/process.hpp"
+#include "proc/reactor.hpp"
+#include "proc/reaper.hpp"
+#include "proc/sealed_data.hpp"
+#include "proc/split.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
 #include <csignal>
-#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <streambuf>
+#include <string>
 #include <system_error>
+#include <utility>
+#include <vector>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -22,79 +57,570 @@ namespace pgm
 {
 
 ////////////////////////////////////////////////////////////////////////////////
-// Input streambuf on an open file descriptor.
+// I/O counters of streambuf.
 //
-// Uses C-style I/O to read from file.
+// Updated with relaxed atomics, so they can be read by other threads
+// while the streambuf is in use.
+//
+struct io_counters
+{
+    std::atomic<std::uint64_t> bytes { 0 }, calls { 0 };
+    std::atomic<std::int64_t> blocked { 0 }; // nsec
+
+    // make read or write call and count it
+    template<typename Fn>
+    ssize_t operator()(Fn fn)
+    {
+        using namespace std::chrono;
+        auto start = steady_clock::now();
+        ssize_t n = fn();
+        auto time = duration_cast<nanoseconds>(steady_clock::now() - start);
+
+        calls.fetch_add(1, std::memory_order_relaxed);
+        if(n > 0) bytes.fetch_add(n, std::memory_order_relaxed);
+        blocked.fetch_add(time.count(), std::memory_order_relaxed);
+        return n;
+    }
+
+    // get counters and number of bytes in pipe fd
+    io_stats stats(int fd) const noexcept
+    {
+        io_stats s;
+        s.bytes = bytes.load(std::memory_order_relaxed);
+        s.calls = calls.load(std::memory_order_relaxed);
+        s.blocked = std::chrono::nanoseconds(blocked.load(std::memory_order_relaxed));
+
+        int n = 0;
+        if(!::ioctl(fd, FIONREAD, &n)) s.backlog = n;
+        return s;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Input streambuf on an open file descriptor, which it owns.
+//
+// Reads from file in large chunks into its own buffer.
 // Supports one character putback.
 //
+// Also gives direct access to the buffer (see for_each()).
+//
 class ifilebuf : public std::streambuf
 {
 public:
     ////////////////////
-    explicit ifilebuf(int fd) : file_(fdopen(fd, "r"))
+    explicit ifilebuf(int fd, std::size_t size = 64 * 1024) :
+        fd_(fd), size_(size), buffer_(new char_type[size_])
+    { setg(buffer_.get() + 1, buffer_.get() + 1, buffer_.get() + 1); }
+    ~ifilebuf() { ::close(fd_); }
+
+    int fd() const noexcept { return fd_; }
+
+    io_stats stats() const noexcept { return io_.stats(fd_); }
+
+    // report time until first byte is read (see metrics::first_output)
+    void track_first(std::chrono::steady_clock::time_point started) noexcept
+    {
+        started_ = started;
+        track_ = true;
+    }
+
+    ////////////////////
+    // call fn for each record framed as described by f
+    void for_each(const framing& f, const std::function<void(std::string_view)>& fn)
     {
-        if(!file_) throw posix::errno_error();
-        setg(&buffer_, &buffer_ + sizeof(buffer_), &buffer_ + sizeof(buffer_));
+        switch(f.type)
+        {
+        case framing::delimiter: return for_each_delimited(f, fn);
+        case framing::u32:
+        case framing::varint   : return for_each_prefixed(f, fn);
+        case framing::packet   : return for_each_packet(f, fn);
+        }
     }
 
 protected:
+    ////////////////////
+    // records terminated by delim, including the last one,
+    // which may be unterminated
+    void for_each_delimited(const framing& f, const std::function<void(std::string_view)>& fn)
+    {
+        std::string spill; // oversized record
+        for(;;)
+        {
+            if(spill.empty())
+            {
+                auto end = split(gptr(), egptr(), f.delim, fn);
+                setg(eback(), const_cast<char_type*>(end), egptr());
+            }
+            else if(auto end = static_cast<char_type*>(std::memchr(gptr(), f.delim, egptr() - gptr())))
+            {
+                append(spill, end - gptr(), f);
+                gbump(1);
+
+                fn(spill);
+                spill.clear();
+                continue;
+            }
+
+            // buffer is full or we are spilling
+            if(full() || spill.size()) append(spill, egptr() - gptr(), f);
+
+            auto n = fill();
+            if(n == -1) throw posix::errno_error();
+            if(n == 0) break;
+        }
+
+        if(spill.size() || gptr() < egptr())
+        {
+            append(spill, egptr() - gptr(), f);
+            fn(spill);
+        }
+    }
+
+    // length-prefixed records
+    void for_each_prefixed(const framing& f, const std::function<void(std::string_view)>& fn)
+    {
+        for(;;)
+        {
+            std::size_t size, head = f.type == framing::u32 ? u32_prefix(size) : varint_prefix(size);
+            if(head)
+            {
+                if(size > f.max_size) throw std::system_error(posix::errc::message_size);
+
+                // size comes from the stream, so don't add it to anything
+                auto avail = static_cast<std::size_t>(egptr() - gptr());
+                if(size <= avail - head)
+                {
+                    fn(std::string_view(gptr() + head, size));
+                    gbump(head + size);
+                    continue;
+                }
+                if(size >= size_ - head)
+                {
+                    // doesn't fit into the buffer
+                    gbump(head);
+
+                    std::string spill(size, '\0');
+                    auto c = std::min<std::size_t>(size, egptr() - gptr());
+                    std::memcpy(&spill[0], gptr(), c);
+                    gbump(c);
+
+                    for(auto p = &spill[0] + c, e = &spill[0] + size; p < e; )
+                    {
+                        auto r = read(p, e - p);
+                        if(r == -1 && errno == EINTR) continue;
+                        if(r == -1) throw posix::errno_error();
+                        if(r ==  0) throw std::system_error(posix::errc::bad_message);
+                        p += r;
+                    }
+
+                    fn(spill);
+                    continue;
+                }
+            }
+
+            auto n = fill();
+            if(n == -1) throw posix::errno_error();
+            if(n == 0) break;
+        }
+
+        // truncated record
+        if(gptr() < egptr()) throw std::system_error(posix::errc::bad_message);
+    }
+
+    // one record per read (pipe in packet mode)
+    void for_each_packet(const framing& f, const std::function<void(std::string_view)>& fn)
+    {
+        for(;;)
+        {
+            if(gptr() < egptr())
+            {
+                auto size = static_cast<std::size_t>(egptr() - gptr());
+                if(size > f.max_size) throw std::system_error(posix::errc::message_size);
+
+                fn(std::string_view(gptr(), size));
+                setg(eback(), egptr(), egptr());
+            }
+
+            auto n = fill();
+            if(n == -1) throw posix::errno_error();
+            if(n == 0) break;
+        }
+    }
+
+    ////////////////////
+    bool full() const noexcept
+    { return egptr() - gptr() + 1 == static_cast<std::ptrdiff_t>(size_); }
+
+    // move n chars to spill, throw if it grows beyond max_size
+    void append(std::string& spill, std::size_t n, const framing& f)
+    {
+        if(spill.size() + n > f.max_size) throw std::system_error(posix::errc::message_size);
+        spill.append(gptr(), n);
+        gbump(n);
+    }
+
+    // parse length prefix and return its size or 0 if incomplete
+    std::size_t u32_prefix(std::size_t& size) const noexcept
+    {
+        if(egptr() - gptr() < 4) return 0;
+
+        auto p = reinterpret_cast<const unsigned char*>(gptr());
+        size = std::size_t(p[0]) | std::size_t(p[1]) << 8 | std::size_t(p[2]) << 16 | std::size_t(p[3]) << 24;
+        return 4;
+    }
+
+    std::size_t varint_prefix(std::size_t& size) const
+    {
+        size = 0;
+        auto p = reinterpret_cast<const unsigned char*>(gptr());
+        for(std::size_t i = 0; p + i < reinterpret_cast<const unsigned char*>(egptr()); ++i)
+        {
+            if(i == 10) throw std::system_error(posix::errc::bad_message);
+
+            size |= std::size_t(p[i] & 0x7f) << (7 * i);
+            if(!(p[i] & 0x80)) return i + 1;
+        }
+        return 0;
+    }
+
     ////////////////////
     virtual int_type underflow() override
     {
-        auto ch = std::fgetc(file_);
-        if(ch != traits_type::eof()) { buffer_ = ch; gbump(-1); }
-        return ch;
+        if(gptr() == egptr() && fill() <= 0) return traits_type::eof();
+        return traits_type::to_int_type(*gptr());
     }
 
     virtual std::streamsize xsgetn(char_type* s, std::streamsize n) override
     {
-        auto c = 0;
-        if(n > 0 && gptr() < egptr()) { *s = buffer_; gbump(1); ++c; ++s; --n; }
+        std::streamsize c = 0;
+        while(c < n)
+        {
+            if(gptr() == egptr())
+            {
+                // large reads bypass the buffer
+                if(n - c >= static_cast<std::streamsize>(size_))
+                {
+                    auto r = read(s + c, n - c);
+                    if(r == -1 && errno == EINTR) continue;
+                    if(r <= 0) break;
+
+                    c += r;
+                    continue;
+                }
+                if(fill() <= 0) break;
+            }
+
+            auto r = std::min<std::streamsize>(n - c, egptr() - gptr());
+            std::memcpy(s + c, gptr(), r);
+            gbump(r);
+            c += r;
+        }
+        return c;
+    }
+
+    ////////////////////
+    // move unread data to the front of the buffer (keeping one char
+    // for putback) and read more after it
+    //
+    // returns number of chars read, 0 on eof or -1 on error
+    ssize_t fill()
+    {
+        auto n = egptr() - gptr();
+        auto keep = gptr() > eback();
+        auto back = keep ? gptr()[-1] : 0;
+
+        std::memmove(buffer_.get() + 1, gptr(), n);
+
+        auto p = buffer_.get();
+        p[0] = back;
+
+        ssize_t r;
+        do r = read(p + 1 + n, size_ - 1 - n);
+        while(r == -1 && errno == EINTR);
 
-        return c + std::fread(s, sizeof(char_type), n, file_);
+        setg(p + (keep ? 0 : 1), p + 1, p + 1 + n + std::max<ssize_t>(r, 0));
+        return r;
     }
 
-    virtual int_type pbackfail(int_type ch = traits_type::eof()) override
+    ssize_t read(char_type* p, std::size_t n)
     {
-        if(eback() < gptr())
+        auto r = io_([&]{ return ::read(fd_, p, n); });
+        if(r > 0 && track_)
         {
-            if(ch != traits_type::eof()) buffer_ = ch;
-            gbump(-1);
-            return 0;
+            track_ = false;
+            metrics::observe(metrics::first_output, std::chrono::steady_clock::now() - started_);
         }
-        else return traits_type::eof();
+        return r;
     }
 
     ////////////////////
-    std::FILE* file_;
-    char_type buffer_; // buffer to enable putback of one char
+    int fd_;
+    io_counters io_;
+
+    std::chrono::steady_clock::time_point started_;
+    bool track_ = false;
+
+    std::size_t size_;
+    std::unique_ptr<char_type[]> buffer_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
-// Input streambuf on an open file descriptor.
+// Output streambuf on an open file descriptor, which it owns.
 //
-// Uses C-style I/O to read from file.
-// Supports one character putback.
+// Buffers output and writes it to file in large chunks.
+//
+// Also supports zero-copy writes to a pipe (see gift()), in which case
+// the user pages are mapped into the pipe and must stay untouched
+// until the reader has consumed them.
 //
 class ofilebuf : public std::streambuf
 {
 public:
     ////////////////////
-    explicit ofilebuf(int fd) : file_(fdopen(fd, "w"))
-    { if(!file_) throw posix::errno_error(); }
+    explicit ofilebuf(int fd, std::size_t size = 64 * 1024) :
+        fd_(fd), size_(size), buffer_(new char_type[size_])
+    { setp(buffer_.get(), buffer_.get() + size_); }
+    ~ofilebuf()
+    {
+        if(pptr() > pbase())
+        {
+            // don't get killed by SIGPIPE if the reader is gone
+            sigset_t pipe, old, pending;
+            ::sigemptyset(&pipe);
+            ::sigaddset(&pipe, SIGPIPE);
+            ::pthread_sigmask(SIG_BLOCK, &pipe, &old);
+            ::sigpending(&pending);
+
+            sync(); // best effort
+
+            // consume our SIGPIPE, unless one was pending already
+            if(!::sigismember(&pending, SIGPIPE))
+            {
+                timespec zero { };
+                ::sigtimedwait(&pipe, nullptr, &zero);
+            }
+            ::pthread_sigmask(SIG_SETMASK, &old, nullptr);
+        }
+        ::close(fd_);
+    }
+
+    int fd() const noexcept { return fd_; }
+
+    io_stats stats() const noexcept { return io_.stats(fd_); }
+
+    ////////////////////
+    // map [data, data + size) into the pipe using vmsplice(2)
+    // and call done() once the reader has consumed it
+    void gift(const char* data, std::size_t size, std::function<void()> done)
+    {
+        reclaim();
+
+        // preserve ordering with buffered data
+        if(!flush()) throw posix::errno_error();
+
+        iovec iov { const_cast<char*>(data), size };
+        while(iov.iov_len)
+        {
+            ssize_t n;
+            if(spliced_)
+            {
+                n = io_([&]{ return ::vmsplice(fd_, &iov, 1, 0); });
+                if(n == -1)
+                {
+                    posix::errno_error error;
+                    if(error.code() == std::errc::interrupted) continue;
+
+                    // not a pipe or no vmsplice support: fall back to write
+                    if(error.code() != std::errc::invalid_argument
+                        && error.code() != std::errc::function_not_supported) throw error;
+
+                    spliced_ = false;
+                }
+            }
+            if(!spliced_)
+            {
+                n = io_([&]{ return ::write(fd_, iov.iov_base, iov.iov_len); });
+                if(n == -1)
+                {
+                    posix::errno_error error;
+                    if(error.code() == std::errc::interrupted) continue;
+                    throw error;
+                }
+            }
+
+            iov.iov_base = static_cast<char*>(iov.iov_base) + n;
+            iov.iov_len -= n;
+            count_ += n;
+        }
+
+        // when falling back to write(2) the data has already been
+        // copied, so the buffer may be reused right away
+        if(done)
+        {
+            if(spliced_) gifts_.push_back({ count_, std::move(done) });
+            else done();
+        }
+    }
+
+    // call done() for gifts that have been consumed by the reader
+    // and return number of gifts still in flight
+    std::size_t reclaim()
+    {
+        if(gifts_.size())
+        {
+            int unread = 0;
+            if(::ioctl(fd_, FIONREAD, &unread) == -1)
+                throw posix::errno_error();
+
+            auto consumed = count_ - unread;
+            while(gifts_.size() && gifts_.front().end <= consumed)
+            {
+                auto done = std::move(gifts_.front().done);
+                gifts_.pop_front();
+                done();
+            }
+        }
+        return gifts_.size();
+    }
+
+    // call done() for all gifts, eg, when the reader is gone
+    void release() noexcept
+    {
+        while(gifts_.size())
+        {
+            auto done = std::move(gifts_.front().done);
+            gifts_.pop_front();
+            try { done(); } catch(...) { }
+        }
+    }
 
 protected:
     ////////////////////
-    virtual int sync() override { return std::fflush(file_); }
+    virtual int sync() override { return flush() ? 0 : -1; }
+
+    virtual int_type overflow(int_type ch = traits_type::eof()) override
+    {
+        if(!flush()) return traits_type::eof();
+        if(traits_type::eq_int_type(ch, traits_type::eof())) return traits_type::not_eof(ch);
+
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+        return ch;
+    }
 
     virtual std::streamsize xsputn(const char_type* s, std::streamsize n) override
-    { return std::fwrite(s, sizeof(char_type), n, file_); }
+    {
+        // large writes bypass the buffer
+        if(n >= static_cast<std::streamsize>(size_))
+            return flush() ? write(s, n) : 0;
 
-    virtual int_type overflow(int_type ch = traits_type::eof()) override
-    { return std::fputc(ch, file_); }
+        return std::streambuf::xsputn(s, n);
+    }
+
+    ////////////////////
+    // write out and empty the buffer;
+    // returns false on error, in which case errno is set
+    bool flush()
+    {
+        auto n = pptr() - pbase();
+        auto c = write(pbase(), n);
+
+        // drop what couldn't be written
+        setp(buffer_.get(), buffer_.get() + size_);
+        return c == n;
+    }
+
+    // write [p, p + n) to file;
+    // returns number of chars written, which is less than n on error
+    std::streamsize write(const char_type* p, std::streamsize n)
+    {
+        std::streamsize c = 0;
+        while(c < n)
+        {
+            auto r = io_([&]{ return ::write(fd_, p + c, n - c); });
+            if(r == -1 && errno == EINTR) continue;
+            if(r == -1) break;
+
+            c += r;
+        }
+        count_ += c;
+        return c;
+    }
+
+    ////////////////////
+    int fd_;
+    io_counters io_;
+
+    std::size_t size_;
+    std::unique_ptr<char_type[]> buffer_;
+
+    // total number of bytes written to file
+    std::uint64_t count_ = 0;
+
+    // gifts in flight
+    struct gift_t
+    {
+        std::uint64_t end; // value of count_ after this gift
+        std::function<void()> done;
+    };
+    std::deque<gift_t> gifts_;
+
+    bool spliced_ = true; // false if vmsplice is not supported
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Memory file (memfd) capturing output of process.
+//
+// Mapped into memory in its entirety on first access.
+//
+class memfile
+{
+public:
+    ////////////////////
+    explicit memfile(int fd) noexcept : fd_(fd) { }
+    ~memfile()
+    {
+        if(size_) ::munmap(data_, size_);
+        ::close(fd_);
+    }
+
+    memfile(const memfile&) = delete;
+    memfile& operator=(const memfile&) = delete;
+
+    int fd() const noexcept { return fd_; }
 
     ////////////////////
-    std::FILE* file_;
+    std::string_view view()
+    {
+        if(!mapped_)
+        {
+            // children of the process may still have it open, so freeze it
+            // before mapping; otherwise they could change the view or
+            // truncate the file under it (and get us killed by SIGBUS)
+            if(::fcntl(fd_, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL))
+                throw posix::errno_error();
+
+            struct stat st;
+            if(::fstat(fd_, &st)) throw posix::errno_error();
+
+            if(st.st_size)
+            {
+                data_ = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+                if(data_ == MAP_FAILED) throw posix::errno_error();
+                size_ = st.st_size;
+            }
+            mapped_ = true;
+        }
+        return std::string_view(static_cast<const char*>(data_), size_);
+    }
+
+private:
+    ////////////////////
+    int fd_;
+
+    void* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool mapped_ = false;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -105,10 +631,21 @@ using fd_pipe = int[2];
 static constexpr auto rd = 0;
 static constexpr auto wr = 1;
 
-// open pipe
-void open(fd_pipe fp)
+// open pipe; close-on-exec, so that children spawned
+// by other threads in the meantime don't inherit it
+void open(fd_pipe fp, int flags = 0)
 {
-    if(::pipe(fp)) throw posix::errno_error();
+    if(::pipe2(fp, flags | O_CLOEXEC)) throw posix::errno_error();
+}
+
+// open file instead of pipe,
+// for reading (rd) or writing (wr) on the given end
+void open(fd_pipe fp, const spawn_options::file& file, int end)
+{
+    auto flags = end == rd ? O_RDONLY : O_WRONLY | O_CREAT | (file.append ? O_APPEND : O_TRUNC);
+
+    fp[end] = ::open(file.path.data(), flags | O_CLOEXEC, 0666);
+    if(fp[end] == -1) throw posix::errno_error();
 }
 
 // close pipe
@@ -122,7 +659,9 @@ void close(fd_pipe fp) noexcept
 // and close read end
 void write_to(fd_pipe fp, int fd)
 {
-    if(::dup2(fp[wr], fd) == -1) throw posix::errno_error();
+    // dup2 doesn't clear O_CLOEXEC if it's already there
+    if(fp[wr] == fd) ::fcntl(fd, F_SETFD, 0);
+    else if(::dup2(fp[wr], fd) == -1) throw posix::errno_error();
     ::close(fp[rd]);
 }
 
@@ -130,38 +669,373 @@ void write_to(fd_pipe fp, int fd)
 // and close write end
 void read_from(fd_pipe fp, int fd)
 {
-    if(::dup2(fp[rd], fd) == -1) throw posix::errno_error();
+    if(fp[rd] == fd) ::fcntl(fd, F_SETFD, 0);
+    else if(::dup2(fp[rd], fd) == -1) throw posix::errno_error();
     ::close(fp[wr]);
 }
 
+// send SIGTERM to process after timeout
+// followed by SIGKILL after grace period
+void set_timeout(std::weak_ptr<process::control> wctl,
+    std::chrono::milliseconds timeout, std::chrono::milliseconds grace)
+{
+    auto& r = reactor::instance();
+    r.schedule(reactor::clock::now() + timeout, [=, &r]()
+    {
+        auto ctl = wctl.lock();
+        if(!ctl || !ctl->signal(SIGTERM)) return;
+        ctl->escalation = escalation::terminated;
+
+        r.schedule(reactor::clock::now() + grace, [=]()
+        {
+            auto ctl = wctl.lock();
+            if(!ctl || !ctl->signal(SIGKILL)) return;
+            ctl->escalation = escalation::killed;
+        });
+    });
+}
+
+// create cgroup for process and apply limits
+// returns empty string if cgroups are not available
+std::string make_cgroup(const spawn_options& options)
+{
+    static std::atomic<unsigned> count { 0 };
+    auto path = options.cgroup_parent + "/pgm-" + std::to_string(::getpid())
+        + '-' + std::to_string(++count);
+
+    // one at a time, as the write fails as a whole if any of them
+    // is not delegated to us (they may also be enabled already)
+    for(auto name : { "+cpu", "+memory", "+pids" }) cgroup::enable(options.cgroup_parent, name);
+    if(!cgroup::open(path)) { cgroup::remove(path); return { }; }
+
+    // controllers available in the new cgroup, as " cpu memory ... "
+    std::string controllers = " ";
+    try { controllers += cgroup::read(path, "cgroup.controllers"); }
+    catch(std::system_error&) { }
+    std::replace(controllers.begin(), controllers.end(), '\n', ' ');
+
+    auto set = [&](const char* controller, const char* file, const std::string& value)
+    {
+        if(controllers.find(' ' + std::string(controller) + ' ') == std::string::npos) return;
+
+        try { cgroup::write(path, file, value); }
+        catch(std::system_error&) { }
+    };
+    if(options.cpu_quota.count()) set("cpu", "cpu.max",
+        std::to_string(options.cpu_quota.count()) + ' ' + std::to_string(options.cpu_period.count())
+    );
+    if(options.memory_max) set("memory", "memory.max", std::to_string(options.memory_max));
+    if(options.pids_max) set("pids", "pids.max", std::to_string(options.pids_max));
+
+    return path;
+}
+
+// set CPU affinity of calling process
+void set_affinity(const std::vector<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(auto cpu : cpus) if(cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+
+    if(::sched_setaffinity(0, sizeof(set), &set)) throw posix::errno_error();
+}
+
+// set NUMA memory policy of calling process
+void set_mempolicy(spawn_options::numa_policy policy, const std::vector<int>& nodes)
+{
+    int mode = MPOL_DEFAULT;
+    switch(policy)
+    {
+    case spawn_options::numa_default   : mode = MPOL_DEFAULT   ; break;
+    case spawn_options::numa_bind      : mode = MPOL_BIND      ; break;
+    case spawn_options::numa_preferred : mode = MPOL_PREFERRED ; break;
+    case spawn_options::numa_interleave: mode = MPOL_INTERLEAVE; break;
+    }
+
+    constexpr auto bits = 8 * sizeof(unsigned long);
+    unsigned long mask[1024 / bits] { };
+    for(auto node : nodes)
+        if(node >= 0 && node < 1024) mask[node / bits] |= 1UL << (node % bits);
+
+    if(::syscall(SYS_set_mempolicy, mode, mode == MPOL_DEFAULT ? nullptr : mask, 1024 + 1))
+    {
+        // kernel without NUMA support
+        if(errno != ENOSYS) throw posix::errno_error();
+    }
+}
+
+////////////////////
+// ioprio_set(2) constants
+constexpr int ioprio_who_process = 1;
+constexpr int ioprio_class_shift = 13;
+
+// set nice value of thread or process
+int apply_nice(pid_t pid, int nice) { return ::setpriority(PRIO_PROCESS, pid, nice); }
+
+// set scheduling policy of thread or process
+int apply_sched(pid_t pid, spawn_options::sched_policy policy)
+{
+    int value;
+    switch(policy)
+    {
+    case spawn_options::sched_inherit: return 0;
+    case spawn_options::sched_other  : value = SCHED_OTHER; break;
+    case spawn_options::sched_batch  : value = SCHED_BATCH; break;
+    case spawn_options::sched_idle   : value = SCHED_IDLE ; break;
+    default: errno = EINVAL; return -1;
+    }
+
+    // static priority must be 0 for these
+    sched_param param { };
+    return ::sched_setscheduler(pid, value, &param);
+}
+
+// set I/O scheduling class and level of thread or process
+int apply_ioprio(pid_t pid, spawn_options::io_class io, int level)
+{
+    if(io == spawn_options::io_inherit) return 0;
+    if(io == spawn_options::io_idle) level = 0;
+
+    return ::syscall(SYS_ioprio_set, ioprio_who_process, pid, (io << ioprio_class_shift) | level);
+}
+
+// call fn for each thread of process
+// (where fn returns -1 and sets errno on error)
+template<typename Fn>
+void for_each_thread(pid_t pid, Fn fn)
+{
+    auto path = "/proc/" + std::to_string(pid) + "/task";
+    std::unique_ptr<DIR, int(*)(DIR*)> dir(::opendir(path.data()), &::closedir);
+
+    // no procfs, only main thread then
+    if(!dir)
+    {
+        if(fn(pid)) throw posix::errno_error();
+        return;
+    }
+
+    while(auto entry = ::readdir(dir.get()))
+    {
+        auto tid = std::atoi(entry->d_name);
+
+        // ignore threads which exited in the meantime
+        if(tid > 0 && fn(tid) && errno != ESRCH) throw posix::errno_error();
+    }
+}
+
+// move parent fds out of the way of stdio and child fd numbers,
+// so that they can be overlapping or swapped (see remap())
+// returns their new numbers
+std::vector<int> park(const std::vector<std::pair<int, int>>& fds)
+{
+    int top = STDERR_FILENO;
+    for(auto& [from, to] : fds) top = std::max({ top, from, to });
+
+    std::vector<int> temp;
+    for(auto& fd : fds)
+    {
+        temp.push_back(::fcntl(fd.first, F_DUPFD_CLOEXEC, top + 1));
+        if(temp.back() == -1) throw posix::errno_error();
+    }
+    return temp;
+}
+
+// move parked fds to child fd numbers
+void remap(const std::vector<std::pair<int, int>>& fds, const std::vector<int>& temp)
+{
+    for(std::size_t i = 0; i < fds.size(); ++i)
+    {
+        // clears O_CLOEXEC on the new fd
+        if(::dup2(temp[i], fds[i].second) == -1) throw posix::errno_error();
+        ::close(temp[i]);
+    }
+}
+
+// close all fds starting with first, except those in keep (sorted)
+void close_others(int first, const std::vector<int>& keep)
+{
+    auto close = [](int from, int to)
+    {
+        if(from > to) return;
+        if(!::syscall(SYS_close_range, from, to, 0)) return;
+
+        // no close_range(2) (Linux < 5.9)
+        std::unique_ptr<DIR, int(*)(DIR*)> dir(::opendir("/proc/self/fd"), &::closedir);
+        if(!dir) throw posix::errno_error();
+
+        std::vector<int> fds;
+        while(auto entry = ::readdir(dir.get()))
+        {
+            auto fd = std::atoi(entry->d_name);
+            if(fd >= from && fd <= to && fd != ::dirfd(dir.get())) fds.push_back(fd);
+        }
+        for(auto fd : fds) ::close(fd);
+    };
+
+    for(auto fd : keep)
+    {
+        close(first, fd - 1);
+        first = std::max(first, fd + 1);
+    }
+    close(first, INT_MAX);
+}
+
+////////////////////
+// apply options in the child before running fn
+// (parked are fds to pass on, see park())
+void setup(const spawn_options& options, const std::vector<int>& parked)
+{
+    if(options.pgid != -1 && ::setpgid(0, options.pgid)) throw posix::errno_error();
+
+    if(options.cgroup.size() && !cgroup::attach(options.cgroup.data()))
+        throw posix::errno_error();
+
+    if(options.cpus.size()) set_affinity(options.cpus);
+    if(options.numa != spawn_options::numa_default || options.nodes.size())
+        set_mempolicy(options.numa, options.nodes);
+
+    // policy first, since switching to it may not preserve nice value
+    if(apply_sched(0, options.sched)) throw posix::errno_error();
+    if(options.nice && apply_nice(0, *options.nice)) throw posix::errno_error();
+    if(apply_ioprio(0, options.io, options.io_level)) throw posix::errno_error();
+
+    for(auto& limit : options.limits)
+    {
+        rlimit value { limit.soft, limit.hard };
+        if(::setrlimit(limit.resource, &value)) throw posix::errno_error();
+    }
+
+    if(options.fds.size())
+    {
+        remap(options.fds, parked);
+
+        std::vector<int> keep;
+        for(auto& fd : options.fds) keep.push_back(fd.second);
+        if(options.jobserver)
+        {
+            auto pipe = options.jobserver->pipe();
+            keep.insert(keep.end(), { pipe.first, pipe.second });
+        }
+        for(auto data : options.data) keep.push_back(data->fd());
+
+        keep.erase(std::remove(keep.begin(), keep.end(), -1), keep.end());
+        std::sort(keep.begin(), keep.end());
+
+        close_others(STDERR_FILENO + 1, keep);
+    }
+
+    // these clear O_CLOEXEC on their fds
+    if(options.jobserver) options.jobserver->inherit();
+    for(auto data : options.data) data->inherit();
+}
+
+// get errno of exception being handled or 0 if it's not a system error
+int current_errno() noexcept
+{
+    try { throw; }
+    catch(std::system_error& e)
+    {
+        auto& cat = e.code().category();
+        if(cat == std::generic_category() || cat == std::system_category()) return e.code().value();
+    }
+    catch(...) { }
+    return 0;
+}
+
 // create ofilebuf on write end of the pipe
-// and close read end
-auto ofilebuf_from(fd_pipe fp)
+// and close read end (or file, if redirected)
+ofilebuf* ofilebuf_from(fd_pipe fp)
 {
     ::close(fp[rd]);
-    return new ofilebuf(fp[wr]);
+    return fp[wr] == -1 ? nullptr : new ofilebuf(fp[wr]);
 }
 
 // create ofilebuf on read end of the pipe
-// and close write end
-auto ifilebuf_from(fd_pipe fp)
+// and close write end (or file, if redirected)
+ifilebuf* ifilebuf_from(fd_pipe fp)
 {
     ::close(fp[wr]);
-    return new ifilebuf(fp[rd]);
+    return fp[rd] == -1 ? nullptr : new ifilebuf(fp[rd]);
 }
 
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-process::process(std::function<int()>&& fn)
+process::process(const spawn_options& options, std::function<int()>&& fn)
 {
-    fd_pipe fpo, fpi, fpe;
+    auto start = std::chrono::steady_clock::now();
+
+    fd_pipe fpo { -1, -1 }, fpi { -1, -1 }, fpe { -1, -1 };
+    std::string own;
     try
     {
-        open(fpo);
-        open(fpi);
-        open(fpe);
+        if(options.capture_out)
+        {
+            if(options.out.path.size()) throw std::system_error(posix::errc::invalid_argument);
+
+            // the child writes to it and we map it after it exits
+            fpo[wr] = ::memfd_create("pgm-out", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+            if(fpo[wr] == -1) throw posix::errno_error();
+        }
+        else if(options.out.path.size()) open(fpo, options.out, wr);
+        else open(fpo, options.packet_out ? O_DIRECT : 0);
+
+        if(options.in.path.size()) open(fpi, options.in, rd);
+        else open(fpi);
+
+        if(options.err.path.size()) open(fpe, options.err, wr);
+        else open(fpe, options.packet_err ? O_DIRECT : 0);
+
+        // options resolved for the child
+        auto child = options;
+
+        // check fd map here rather than fail in the child
+        for(std::size_t i = 0; i < options.fds.size(); ++i)
+        {
+            auto [from, to] = options.fds[i];
+            if(to <= STDERR_FILENO) throw std::system_error(posix::errc::invalid_argument);
+            if(::fcntl(from, F_GETFD) == -1) throw posix::errno_error();
+
+            for(std::size_t j = 0; j < i; ++j)
+                if(options.fds[j].second == to) throw std::system_error(posix::errc::invalid_argument);
+        }
+
+        // resources held until the process finishes;
+        // get jobserver token first, as it may block
+        std::vector<std::shared_ptr<void>> leases;
+        if(options.jobserver) leases.push_back(options.jobserver->acquire());
+
+        ////////////////////
+        // process group and cgroup
+        std::unique_lock<std::mutex> lock;
+        if(auto group = options.group)
+        {
+            // hold on to the group until we've added ourselves to it
+            lock = std::unique_lock<std::mutex>(group->mutex_);
+            group->prune();
+
+            child.pgid = group->pgid_;
+            child.cgroup = group->cgroup_;
+        }
+        else if(child.cgroup.size() && !cgroup::open(child.cgroup)) throw posix::errno_error();
+
+        // own cgroup with limits
+        if(options.cgroup_parent.size()) own = make_cgroup(options);
+        if(own.size()) child.cgroup = own;
 
+        ////////////////////
+        // CPU and NUMA placement
+        if(options.placement)
+        {
+            placement::slot slot;
+            leases.push_back(options.placement->acquire(slot));
+
+            child.cpus = std::move(slot.cpus);
+            child.numa = slot.bind ? spawn_options::numa_bind : spawn_options::numa_preferred;
+            child.nodes = { slot.node };
+        }
+
+        ////////////////////
         id_ = id(::fork());
         if(native_handle() == -1) throw posix::errno_error();
 
@@ -169,12 +1043,20 @@ process::process(std::function<int()>&& fn)
         // child
         if(native_handle() == 0)
         {
-            write_to (fpo, STDOUT_FILENO);
-            read_from(fpi, STDIN_FILENO );
-            write_to (fpe, STDERR_FILENO);
-
             int code;
-            try { code = fn(); } catch(...) { code = EXIT_FAILURE; }
+            try
+            {
+                // before stdio, which may be among them
+                auto parked = park(child.fds);
+
+                write_to (fpo, STDOUT_FILENO);
+                read_from(fpi, STDIN_FILENO );
+                write_to (fpe, STDERR_FILENO);
+
+                setup(child, parked);
+                code = fn();
+            }
+            catch(...) { code = EXIT_FAILURE; }
 
             std::exit(code);
         }
@@ -183,7 +1065,12 @@ process::process(std::function<int()>&& fn)
         // parent
         else
         {
-            fbo_.reset(ifilebuf_from(fpo));
+            if(options.capture_out)
+            {
+                mfo_.reset(new memfile(fpo[wr]));
+                fpo[wr] = -1;
+            }
+            else fbo_.reset(ifilebuf_from(fpo));
             cout.basic_ios::rdbuf(fbo_.get());
 
             fbi_.reset(ofilebuf_from(fpi));
@@ -192,7 +1079,33 @@ process::process(std::function<int()>&& fn)
             fbe_.reset(ifilebuf_from(fpe));
             cerr.basic_ios::rdbuf(fbe_.get());
 
-            state_ = running;
+            ctl_ = std::make_shared<control>(native_handle());
+            ctl_->cgroup = std::move(own);
+            ctl_->leases = std::move(leases);
+
+            // hard CPU limit, set or inherited
+            rlimit cpu;
+            if(!::getrlimit(RLIMIT_CPU, &cpu)) ctl_->cpu_limit = cpu.rlim_max;
+            for(auto& limit : options.limits)
+                if(limit.resource == RLIMIT_CPU) ctl_->cpu_limit = limit.hard;
+
+            // group members are always watched
+            if(reaper::enabled() || options.group) ctl_->watch();
+            if(options.timeout.count()) set_timeout(ctl_, options.timeout, options.grace);
+
+            // also set it from here to avoid race with the child
+            if(child.pgid != -1) ::setpgid(native_handle(), child.pgid ? child.pgid : native_handle());
+
+            if(auto group = options.group)
+            {
+                if(!group->pgid_) group->pgid_ = native_handle();
+                group->members_.push_back(ctl_);
+            }
+
+            if(fbo_) fbo_->track_first(ctl_->started);
+
+            metrics::spawned();
+            metrics::observe(metrics::spawn_latency, std::chrono::steady_clock::now() - start);
         }
     }
     catch(...)
@@ -200,7 +1113,9 @@ process::process(std::function<int()>&& fn)
         close(fpo);
         close(fpi);
         close(fpe);
+        if(own.size()) cgroup::remove(own);
 
+        metrics::spawn_failed(current_errno());
         throw;
     }
 }
@@ -228,12 +1143,11 @@ void process::swap(process& rhs) noexcept
 {
     using std::swap;
     swap(id_    , rhs.id_    );
-    swap(state_ , rhs.state_ );
-    swap(code_  , rhs.code_  );
-    swap(signal_, rhs.signal_);
+    swap(ctl_   , rhs.ctl_   );
     swap(fbi_   , rhs.fbi_   );
     swap(fbo_   , rhs.fbo_   );
     swap(fbe_   , rhs.fbe_   );
+    swap(mfo_   , rhs.mfo_   );
 
     cout.basic_ios::rdbuf(fbo_.get());
     cin.basic_ios::rdbuf(fbi_.get());
@@ -243,33 +1157,35 @@ void process::swap(process& rhs) noexcept
 ////////////////////////////////////////////////////////////////////////////////
 state process::state()
 {
-    while(state_ == running || state_ == stopped)
-    {
-        int status;
-        auto pid = ::waitpid(native_handle(), &status, WNOHANG);
-        if(pid == -1)
-        {
-            posix::errno_error error;
-            if(error.code() == std::errc::no_child_process)
-            {
-                // This could happen for the following reasons:
-                // 1. process was never started;
-                // 2. SA_NOCLDWAIT is set or SIGCHLD is set to SIG_IGN.
-                // In case of (2) we don't know if the process exited
-                // normally or due to a signal, so set it to not_started.
-                state_ = not_started;
-            }
-            else throw error;
-        }
-        else if(pid == 0) break; // no change
-        else if(pid == native_handle()) update(status);
-    }
+    if(!ctl_) return not_started;
+
+    // watched processes are collected by the reactor
+    if(!ctl_->watched()) ctl_->collect();
 
-    return state_;
+    auto status = ctl_->status();
+    if(finished(status.state) && joinable()) update(status);
+    return status.state;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void process::detach() noexcept { id_ = id(); state_ = not_started; }
+exit_status process::status() const noexcept
+{ return ctl_ ? ctl_->status() : exit_status { }; }
+
+int process::code() const noexcept { return status().code; }
+int process::signal() const noexcept { return status().signal; }
+
+////////////////////////////////////////////////////////////////////////////////
+void process::wait_exit() const
+{
+    if(!ctl_) throw std::system_error(posix::errc::invalid_argument);
+    if(!ctl_->watched() && !ctl_->watch())
+        throw std::system_error(posix::errc::function_not_supported);
+
+    ctl_->wait();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void process::detach() noexcept { id_ = id(); ctl_.reset(); }
 
 ////////////////////////////////////////////////////////////////////////////////
 void process::join()
@@ -278,21 +1194,8 @@ void process::join()
     if(get_id() == this_process::get_id())
         throw std::system_error(posix::errc::resource_deadlock_would_occur);
 
-    while(state_ == running || state_ == stopped)
-    {
-        int status;
-        auto pid = ::waitpid(native_handle(), &status, 0);
-        if(pid == -1)
-        {
-            posix::errno_error error;
-            if(error.code() == std::errc::no_child_process)
-            {
-                state_ = not_started; // see process::state()
-            }
-            else throw error;
-        }
-        else if(pid == native_handle()) update(status);
-    }
+    ctl_->join();
+    update(ctl_->status());
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -302,8 +1205,38 @@ bool process::try_join_for_(const nsec& time)
     if(get_id() == this_process::get_id())
         throw std::system_error(posix::errc::resource_deadlock_would_occur);
 
-    state(); // update state
-    if(state_ != running && state_ != stopped) return true;
+    if(finished(state())) return true;
+
+    if(ctl_->watched())
+    {
+        ctl_->wait_for(time);
+        return finished(state());
+    }
+
+    auto sec = std::chrono::duration_cast<std::chrono::seconds>(time);
+    timespec tv { sec.count(), (time - sec).count() };
+
+    ////////////////////
+    // pidfd becomes readable when the process exits
+    if(ctl_->pidfd() != -1)
+    {
+        pollfd fd { ctl_->pidfd(), POLLIN, 0 };
+
+        auto until = std::chrono::steady_clock::now() + time;
+        while(::ppoll(&fd, 1, &tv, nullptr) == -1)
+        {
+            posix::errno_error error;
+            if(error.code() != std::errc::interrupted) throw error;
+
+            auto left = std::chrono::duration_cast<nsec>(until - std::chrono::steady_clock::now());
+            if(left.count() < 0) left = nsec::zero();
+
+            auto sec = std::chrono::duration_cast<std::chrono::seconds>(left);
+            tv = timespec { sec.count(), (left - sec).count() };
+        }
+
+        return finished(state());
+    }
 
     ////////////////////
     struct guard
@@ -316,16 +1249,12 @@ bool process::try_join_for_(const nsec& time)
     signal;
 
     ////////////////////
-    auto sec = std::chrono::duration_cast<std::chrono::seconds>(time);
-    timespec tv { sec.count(), (time - sec).count() };
-
     while(::nanosleep(&tv, &tv) == -1)
     {
         posix::errno_error error;
         if(error.code() == std::errc::interrupted)
         {
-            state(); // update state_
-            if(state_ != running && state_ != stopped) return true;
+            if(finished(state())) return true;
         }
         else throw error;
     }
@@ -337,33 +1266,219 @@ void process::raise(int signal)
 {
     if(!joinable()) throw std::system_error(posix::errc::invalid_argument);
 
-    if(int code = ::kill(native_handle(), signal))
+    ctl_->signal(signal);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void process::set_nice(int nice)
+{
+    if(!joinable()) throw std::system_error(posix::errc::invalid_argument);
+
+    ctl_->with_pid([&](pid_t pid)
     {
-        posix::errno_error error;
-        if(error.code() != std::errc::no_such_process) throw error;
-    }
+        for_each_thread(pid, [&](pid_t tid){ return apply_nice(tid, nice); });
+    });
+}
+
+void process::set_sched(spawn_options::sched_policy policy)
+{
+    if(!joinable()) throw std::system_error(posix::errc::invalid_argument);
+
+    ctl_->with_pid([&](pid_t pid)
+    {
+        for_each_thread(pid, [&](pid_t tid){ return apply_sched(tid, policy); });
+    });
+}
+
+void process::set_io_priority(spawn_options::io_class io, int level)
+{
+    if(!joinable()) throw std::system_error(posix::errc::invalid_argument);
+
+    ctl_->with_pid([&](pid_t pid)
+    {
+        for_each_thread(pid, [&](pid_t tid){ return apply_ioprio(tid, io, level); });
+    });
+}
+
+void process::set_limit(int resource, rlim_t soft, rlim_t hard)
+{
+    if(!joinable()) throw std::system_error(posix::errc::invalid_argument);
+
+    ctl_->with_pid([&](pid_t pid)
+    {
+        // enum in glibc, int elsewhere
+        auto res = static_cast<decltype(RLIMIT_CPU)>(resource);
+
+        rlimit value { soft, hard };
+        if(::prlimit(pid, res, &value, nullptr))
+            throw posix::errno_error();
+
+        if(resource == RLIMIT_CPU) ctl_->cpu_limit = hard;
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::future<exit_status> process::exit_future()
+{
+    auto promise = std::make_shared<std::promise<exit_status>>();
+    auto future = promise->get_future();
+
+    then([promise](const exit_status& status){ promise->set_value(status); });
+    return future;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void process::update(int status)
+void process::then(continuation fn)
 {
-    if(WIFEXITED(status))
+    if(!ctl_) throw std::system_error(posix::errc::invalid_argument);
+
+    // control posts fn right away if already finished
+    if(!finished(ctl_->status().state) && !ctl_->watched() && !ctl_->watch())
+        throw std::system_error(posix::errc::function_not_supported);
+
+    ctl_->then(std::move(fn));
+}
+
+void process::then(continuation fn, executor ex)
+{
+    then([=](const exit_status& status){ ex([=]{ fn(status); }); });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+int process::fd(const std::ios& stream) const noexcept
+{
+    if(&stream == &cin ) return fbi_ ? fbi_->fd() : -1;
+    if(&stream == &cout) return fbo_ ? fbo_->fd() : -1;
+    if(&stream == &cerr) return fbe_ ? fbe_->fd() : -1;
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::string_view process::output()
+{
+    if(joinable() || !mfo_) throw std::system_error(posix::errc::invalid_argument);
+    return mfo_->view();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+io_stats process::io(const std::ios& stream) const noexcept
+{
+    if(&stream == &cin  && fbi_) return fbi_->stats();
+    if(&stream == &cout && fbo_) return fbo_->stats();
+    if(&stream == &cerr && fbe_) return fbe_->stats();
+    return io_stats { };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+escalation process::escalation() const noexcept
+{ return ctl_ ? ctl_->escalation.load() : escalation::none; }
+
+overrun process::overrun() const noexcept
+{ return ctl_ ? ctl_->overrun.load() : overrun::none; }
+
+////////////////////////////////////////////////////////////////////////////////
+std::string process::cgroup() const { return ctl_ ? ctl_->cgroup : std::string(); }
+
+////////////////////////////////////////////////////////////////////////////////
+std::optional<cgroup_usage> process::usage() const
+{
+    if(!ctl_ || ctl_->cgroup.empty()) return std::nullopt;
+    auto& path = ctl_->cgroup;
+
+    // missing files (eg, controller not enabled) read as 0
+    auto value = [&](const char* file)
     {
-        state_ = exited;
-        code_ = WEXITSTATUS(status);
-        id_ = id();
-    }
-    else if(WIFSIGNALED(status))
+        try { return cgroup::read_value(path, file); }
+        catch(std::exception&) { return std::uint64_t(0); }
+    };
+    auto key = [&](const char* file, const char* key)
     {
-        state_ = signaled;
-        signal_ = WTERMSIG(status);
-        id_ = id();
-    }
-    else if(WIFSTOPPED(status))
+        try { return cgroup::read_key(path, file, key); }
+        catch(std::exception&) { return std::uint64_t(0); }
+    };
+
+    cgroup_usage usage;
+    usage.memory_current = value("memory.current");
+    usage.memory_peak = value("memory.peak");
+    usage.cpu_usage = key("cpu.stat", "usage_usec");
+    usage.cpu_user = key("cpu.stat", "user_usec");
+    usage.cpu_system = key("cpu.stat", "system_usec");
+    usage.nr_periods = key("cpu.stat", "nr_periods");
+    usage.nr_throttled = key("cpu.stat", "nr_throttled");
+    usage.throttled = key("cpu.stat", "throttled_usec");
+    return usage;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void process::write_gift(const void* data, std::size_t size, std::function<void()> done)
+{
+    if(!joinable() || !fbi_) throw std::system_error(posix::errc::invalid_argument);
+    fbi_->gift(static_cast<const char*>(data), size, std::move(done));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t process::reclaim_gifts() { return fbi_ ? fbi_->reclaim() : 0; }
+
+////////////////////////////////////////////////////////////////////////////////
+void process::for_each_line(const std::function<void(std::string_view)>& fn)
+{
+    if(!fbo_) throw std::system_error(posix::errc::invalid_argument);
+    fbo_->for_each(framing::by_delimiter('\n'), fn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void process::for_each_record(std::istream& is, const framing& f,
+    const std::function<void(std::string_view)>& fn)
+{
+    ifilebuf* fb = nullptr;
+    if(&is == &cout) fb = fbo_.get();
+    else if(&is == &cerr) fb = fbe_.get();
+
+    if(!fb) throw std::system_error(posix::errc::invalid_argument);
+    fb->for_each(f, fn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void process::classify(int signal)
+{
+    constexpr std::chrono::milliseconds cpu_slack { 100 };
+
+    auto overrun = overrun::none;
+    switch(signal)
     {
-        state_ = stopped;
-        signal_ = WSTOPSIG(status);
+    case SIGXCPU: overrun = overrun::cpu; break;
+    case SIGXFSZ: overrun = overrun::file_size; break;
+
+    case SIGKILL:
+        // unless we killed it ourselves
+        if(ctl_->escalation == escalation::killed) break;
+
+        // the kernel sends SIGKILL once hard CPU limit is reached
+        // (allow for the difference in how it accounts CPU time)
+        if(auto limit = ctl_->cpu_limit.load(); limit != RLIM_INFINITY
+            && ctl_->cpu_time + cpu_slack >= std::chrono::seconds(limit)) overrun = overrun::cpu;
+
+        // or the OOM killer got it
+        else if(ctl_->cgroup.size()) try
+        {
+            if(cgroup::read_key(ctl_->cgroup, "memory.events", "oom_kill"))
+                overrun = overrun::memory;
+        }
+        catch(std::exception&) { }
+        break;
     }
+    ctl_->overrun = overrun;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void process::update(const exit_status& status)
+{
+    if(status.state == signaled) classify(status.signal);
+
+    id_ = id();
+
+    // the pipe is gone along with the process
+    if(fbi_) fbi_->release();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
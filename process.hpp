@@ -11,13 +11,23 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include <chrono>
 #include <csignal>
+#include <cstddef>
+#include <cstdint>
 #include <fstream>
 #include <functional>
+#include <future>
 #include <memory>
+#include <optional>
 #include <ostream>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <type_traits>
 #include <utility>
 
+#include "proc/framing.hpp"
+#include "proc/spawn_options.hpp"
+
 ////////////////////////////////////////////////////////////////////////////////
 namespace pgm
 {
@@ -25,6 +35,7 @@ namespace pgm
 ////////////////////////////////////////////////////////////////////////////////
 class ofilebuf;
 class ifilebuf;
+class memfile;
 
 enum state
 {
@@ -35,6 +46,55 @@ enum state
     signaled,
 };
 
+// exit status of process
+struct exit_status
+{
+    pgm::state state = not_started;
+    int code = -1;   // exit code if exited
+    int signal = -1; // signal if signaled
+};
+
+// resource usage of process' cgroup
+struct cgroup_usage
+{
+    std::uint64_t memory_current = 0; // bytes
+    std::uint64_t memory_peak = 0;    // bytes (Linux 5.19+)
+
+    // cpu.stat
+    std::uint64_t cpu_usage = 0; // usec
+    std::uint64_t cpu_user = 0;  // usec
+    std::uint64_t cpu_system = 0;// usec
+    std::uint64_t nr_periods = 0;
+    std::uint64_t nr_throttled = 0;
+    std::uint64_t throttled = 0; // usec
+};
+
+// I/O statistics of process' stdin, stdout or stderr
+struct io_stats
+{
+    std::uint64_t bytes = 0; // written to stdin or read from stdout/stderr
+    std::uint64_t calls = 0; // write(2) or read(2) calls made
+    std::chrono::nanoseconds blocked { 0 }; // time spent in these calls
+    std::size_t backlog = 0; // bytes in the pipe, which haven't been read yet
+};
+
+// outcome of timeout enforcement (see spawn_options::timeout)
+enum class escalation
+{
+    none,       // no timeout or process finished in time
+    terminated, // sent SIGTERM
+    killed,     // sent SIGKILL after grace period
+};
+
+// resource limit which got process killed (see spawn_options::limits)
+enum class overrun
+{
+    none,
+    cpu,       // RLIMIT_CPU (SIGXCPU or SIGKILL)
+    memory,    // killed by OOM killer in process' cgroup
+    file_size, // RLIMIT_FSIZE (SIGXFSZ)
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Creates and manages child process.
 //
@@ -76,9 +136,14 @@ public:
     process(const process&) = delete;
     process(process&&) noexcept;
 
-    template<typename Fn, typename... Args>
+    template<typename Fn, typename... Args,
+        typename = std::enable_if_t<!std::is_same<std::decay_t<Fn>, spawn_options>::value>
+    >
     explicit process(Fn&&, Args&&...);
 
+    template<typename Fn, typename... Args>
+    process(const spawn_options&, Fn&&, Args&&...);
+
     ~process() noexcept;
 
     process& operator=(const process&) = delete;
@@ -96,9 +161,62 @@ public:
     auto native_handle() const noexcept { return id_.handle_; }
 
     // get process state, exit code & signal
+    //
+    // state() checks whether the process has changed state, unless it's
+    // watched by the reaper (see reaper.hpp), in which case it's as cheap
+    // as status() below.
     pgm::state state();
-    int code() const noexcept { return code_; }
-    int signal() const noexcept { return signal_; }
+    int code() const noexcept;
+    int signal() const noexcept;
+
+    // get last known state, exit code & signal
+    //
+    // Lock-free and safe to call from any thread. The status is published
+    // by the reaper as soon as the process exits, or by the thread which
+    // calls state() or join() on this process otherwise.
+    exit_status status() const noexcept;
+
+    // wait for process to finish without reaping it
+    //
+    // Safe to call from any thread. Waits on the published status
+    // and starts watching the process by the reaper if needed.
+    void wait_exit() const;
+
+    // get file descriptor of pipe behind cin, cout or cerr
+    // (eg, to watch it with the reactor) or -1 if none
+    int fd(const std::ios&) const noexcept;
+
+    // get I/O statistics of cin, cout or cerr
+    //
+    // Counters are cheap to maintain and can be read from any thread.
+    // Large backlog on cout or cerr means we don't keep up with the
+    // process, while on cin it means the process doesn't keep up with us.
+    io_stats io(const std::ios&) const noexcept;
+
+    // get output of process captured in memory (see spawn_options::capture_out)
+    //
+    // Can only be called after the process has been joined. Maps the output
+    // into memory without copying it. The view is valid for the lifetime
+    // of this object (including moves) and won't include anything written
+    // afterwards, eg, by children of the process (the output is sealed,
+    // so their writes fail from then on).
+    std::string_view output();
+
+    // get outcome of timeout enforcement
+    pgm::escalation escalation() const noexcept;
+
+    // get resource limit which got process killed, if any
+    //
+    // Exceeding other limits (eg, RLIMIT_AS or RLIMIT_NOFILE) makes
+    // system calls in the process fail rather than kill it.
+    pgm::overrun overrun() const noexcept;
+
+    // get cgroup created for process (see spawn_options::cgroup_parent)
+    // or empty string if none
+    std::string cgroup() const;
+
+    // get resource usage from process' cgroup, if it has one
+    std::optional<cgroup_usage> usage() const;
 
     // detach process
     void detach() noexcept;
@@ -112,35 +230,100 @@ public:
     template<typename Clock, typename Duration>
     bool try_join_until(const std::chrono::time_point<Clock, Duration>&);
 
+    ////////////////////
+    // get future exit status of process
+    std::future<exit_status> exit_future();
+
+    // call fn with exit status when process finishes
+    //
+    // fn runs on the reactor thread or is passed to executor, if given.
+    // Uses the reaper (see reaper.hpp) for this process, whether it was
+    // enabled or not. Throws std::system_error with errc::function_not_supported
+    // if the kernel doesn't support pidfds.
+    using continuation = std::function<void(const exit_status&)>;
+    using executor = std::function<void(std::function<void()>)>;
+
+    void then(continuation fn);
+    void then(continuation fn, executor);
+
     ////////////////////
     // send signal to process
     void raise(int);
     void terminate() { raise(SIGTERM); }
     void kill() { raise(SIGKILL); }
 
+    ////////////////////
+    // change nice value, scheduling policy or I/O priority
+    // of all threads of process (see spawn_options)
+    void set_nice(int);
+    void set_sched(spawn_options::sched_policy);
+    void set_io_priority(spawn_options::io_class, int level = 4);
+
+    // change resource limit of process (see prlimit(2))
+    void set_limit(int resource, rlim_t soft, rlim_t hard);
+
+    ////////////////////
+    // zero-copy write to process' stdin
+    //
+    // Maps pages of the buffer into the pipe with vmsplice(2) instead of
+    // copying them. The buffer must not be modified until done() is called.
+    // This happens in write_gift(), reclaim_gifts() or when the process
+    // exits, whichever comes first after the data has been consumed.
+    void write_gift(const void* data, std::size_t size, std::function<void()> done = { });
+
+    // call done() for consumed buffers
+    // and return number of buffers still in flight
+    std::size_t reclaim_gifts();
+
+    ////////////////////
+    // call fn for each line read from process' stdout
+    //
+    // Lines are passed without the trailing '\n' as views into an internal
+    // buffer, which are only valid for the duration of the call.
+    // Returns when the process closes its stdout.
+    void for_each_line(const std::function<void(std::string_view)>& fn);
+
+    // call fn for each record read from process' stdout or stderr
+    // (passed as cout or cerr respectively)
+    //
+    // Records are passed as views (see for_each_line). Records larger
+    // than the internal buffer are copied, up to framing::max_size bytes.
+    // Throws std::system_error with errc::message_size if a record
+    // is larger than that, or errc::bad_message if it was truncated.
+    void for_each_record(std::istream&, const framing&,
+        const std::function<void(std::string_view)>& fn);
+
     ////////////////////
     std::ofstream cin;
     std::ifstream cout, cerr;
 
+    ////////////////////
+    // state shared with the reactor (internal)
+    struct control;
+
 private:
     ////////////////////
-    process(std::function<int()>&&);
+    process(const spawn_options&, std::function<int()>&&);
 
     ////////////////////
     id id_;
 
-    enum state state_ = not_started;
-    int code_ = -1;
-    int signal_ = -1;
+    // called once the process has been collected
+    void update(const exit_status&);
 
-    void update(int status);
+    // figure out if process was killed for exceeding resource limit
+    void classify(int signal);
 
     using nsec = std::chrono::nanoseconds;
     bool try_join_for_(const nsec&);
 
+    ////////////////////
+    std::shared_ptr<control> ctl_;
+
     ////////////////////
     std::unique_ptr<ofilebuf> fbi_;
     std::unique_ptr<ifilebuf> fbo_, fbe_;
+    std::unique_ptr<memfile> mfo_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -150,9 +333,14 @@ inline bool operator<=(process::id x, process::id y) noexcept { return !(y< x);
 inline bool operator>=(process::id x, process::id y) noexcept { return !(x< y); }
 
 ////////////////////////////////////////////////////////////////////////////////
-template<typename Fn, typename... Args>
+template<typename Fn, typename... Args, typename>
 process::process(Fn&& fn, Args&&... args) :
-    process(std::function<int()>(
+    process(spawn_options(), std::forward<Fn>(fn), std::forward<Args>(args)...)
+{ }
+
+template<typename Fn, typename... Args>
+process::process(const spawn_options& options, Fn&& fn, Args&&... args) :
+    process(options, std::function<int()>(
         std::bind(std::forward<Fn>(fn), std::forward<Args>(args)...))
     )
 { }
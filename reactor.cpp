@@ -0,0 +1,194 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "posix/error.hpp"
+#include "proc/reactor.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+reactor& reactor::instance()
+{
+    static std::mutex mutex;
+    static reactor* instance = nullptr;
+
+    // Intentionally leaked, as the thread runs until the end.
+    // A forked child gets its own reactor.
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!instance || instance->pid_ != ::getpid()) instance = new reactor();
+
+    return *instance;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+reactor::reactor() : pid_(::getpid())
+{
+    epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_ == -1) throw posix::errno_error();
+
+    event_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(event_ == -1) throw posix::errno_error();
+
+    timer_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if(timer_ == -1) throw posix::errno_error();
+
+    for(auto fd : { event_, timer_ })
+    {
+        epoll_event ev { };
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if(::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev)) throw posix::errno_error();
+    }
+
+    std::thread thread(&reactor::run, this);
+    thread_id_ = thread.get_id();
+    thread.detach();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void reactor::add(int fd, std::uint32_t events, callback fn)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fds_[fd] = std::make_shared<callback>(std::move(fn));
+    }
+
+    epoll_event ev { };
+    ev.events = events;
+    ev.data.fd = fd;
+    if(::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &ev))
+    {
+        posix::errno_error error;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        fds_.erase(fd);
+        throw error;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void reactor::remove(int fd) noexcept
+{
+    ::epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    fds_.erase(fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void reactor::post(task fn)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(fn));
+    }
+
+    std::uint64_t n = 1;
+    ::write(event_, &n, sizeof(n));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void reactor::schedule(clock::time_point tp, task fn)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    wheel_.add(tp, std::move(fn));
+    arm();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool reactor::this_thread() const noexcept
+{ return std::this_thread::get_id() == thread_id_; }
+
+////////////////////////////////////////////////////////////////////////////////
+void reactor::arm()
+{
+    auto next = wheel_.next();
+    if(next == armed_) return;
+
+    itimerspec its { };
+    if(next != clock::time_point::max())
+    {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            next.time_since_epoch()
+        ).count();
+        // zero disarms the timer
+        if(ns <= 0) ns = 1;
+
+        its.it_value.tv_sec = ns / 1000000000;
+        its.it_value.tv_nsec = ns % 1000000000;
+    }
+
+    // steady_clock is CLOCK_MONOTONIC
+    ::timerfd_settime(timer_, TFD_TIMER_ABSTIME, &its, nullptr);
+    armed_ = next;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void reactor::run()
+{
+    epoll_event events[64];
+    std::vector<task> tasks;
+
+    for(;;)
+    {
+        auto n = ::epoll_wait(epoll_, events, sizeof(events) / sizeof(events[0]), -1);
+        if(n == -1) continue; // EINTR
+
+        for(auto i = 0; i < n; ++i)
+        {
+            auto fd = events[i].data.fd;
+            if(fd == event_ || fd == timer_)
+            {
+                std::uint64_t count;
+                ::read(fd, &count, sizeof(count));
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                if(fd == event_)
+                {
+                    tasks.insert(tasks.end(),
+                        std::make_move_iterator(tasks_.begin()),
+                        std::make_move_iterator(tasks_.end())
+                    );
+                    tasks_.clear();
+                }
+                else
+                {
+                    armed_ = clock::time_point::max();
+                    wheel_.advance(clock::now(), tasks);
+                    arm();
+                }
+            }
+            else
+            {
+                std::shared_ptr<callback> fn;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    auto it = fds_.find(fd);
+                    if(it != fds_.end()) fn = it->second;
+                }
+                if(fn) try { (*fn)(events[i].events); } catch(...) { }
+            }
+        }
+
+        for(auto& fn : tasks) try { fn(); } catch(...) { }
+        tasks.clear();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,89 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_REACTOR_HPP
+#define PGM_REACTOR_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/timer_wheel.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Event loop running on its own thread.
+//
+// Watches file descriptors with epoll and runs timers off a timer wheel
+// driven by one timerfd. Callbacks run on the reactor thread and should
+// not block.
+//
+// There is one reactor per process, which is started on first use.
+//
+class reactor
+{
+public:
+    ////////////////////
+    using clock = timer_wheel::clock;
+    using callback = std::function<void(std::uint32_t events)>;
+    using task = std::function<void()>;
+
+    static reactor& instance();
+
+    reactor(const reactor&) = delete;
+    reactor& operator=(const reactor&) = delete;
+
+    ////////////////////
+    // watch fd for events (EPOLLIN, etc) and call fn when they occur
+    void add(int fd, std::uint32_t events, callback fn);
+    // stop watching fd
+    void remove(int fd) noexcept;
+
+    // run fn on the reactor thread
+    void post(task fn);
+
+    // run fn on the reactor thread at tp
+    void schedule(clock::time_point tp, task fn);
+
+    // check if called from the reactor thread
+    bool this_thread() const noexcept;
+
+private:
+    ////////////////////
+    reactor();
+
+    pid_t pid_;
+    int epoll_ = -1, event_ = -1, timer_ = -1;
+
+    std::mutex mutex_;
+    std::unordered_map<int, std::shared_ptr<callback>> fds_;
+    std::vector<task> tasks_;
+
+    timer_wheel wheel_;
+    timer_wheel::clock::time_point armed_ = clock::time_point::max();
+
+    std::thread::id thread_id_;
+
+    void run();
+    void arm(); // rearm timerfd (mutex_ must be held)
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
@@ -0,0 +1,40 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_REAPER_HPP
+#define PGM_REAPER_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Central reaper.
+//
+// When enabled, processes started afterwards are watched by the reactor
+// through their pidfds and reaped as soon as they exit. Their exit status
+// is published to the process objects, so process::state() and join()
+// no longer call waitpid and don't interfere with each other.
+//
+// Only exits are tracked: stopped processes are reported as running.
+// On kernels without pidfd support processes are not watched and
+// fall back to waitpid.
+//
+namespace reaper
+{
+
+void enable() noexcept;
+void disable() noexcept;
+bool enabled() noexcept;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
@@ -0,0 +1,454 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "posix/error.hpp"
+#include "proc/charpp.hpp"
+#include "proc/drain.hpp"
+#include "proc/result_cache.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <system_error>
+#include <tuple>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// SHA-256 (FIPS 180-4)
+//
+class sha256
+{
+public:
+    ////////////////////
+    void update(const void* data, std::size_t size)
+    {
+        auto p = static_cast<const unsigned char*>(data);
+        total_ += size;
+
+        while(size)
+        {
+            auto n = std::min(size, sizeof(block_) - used_);
+            std::memcpy(block_ + used_, p, n);
+            used_ += n; p += n; size -= n;
+
+            if(used_ == sizeof(block_)) { compress(); used_ = 0; }
+        }
+    }
+
+    // length-prefixed, so that fields can't run into each other
+    void field(const std::string& s)
+    {
+        std::uint64_t size = s.size();
+        update(&size, sizeof(size));
+        update(s.data(), s.size());
+    }
+
+    std::string hex()
+    {
+        std::uint64_t bits = total_ * 8;
+
+        unsigned char pad = 0x80;
+        update(&pad, 1);
+
+        pad = 0;
+        while(used_ != 56) update(&pad, 1);
+
+        unsigned char length[8];
+        for(auto i = 0; i < 8; ++i) length[i] = bits >> (56 - 8 * i);
+        update(length, 8);
+
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        for(auto h : h_)
+            for(auto i = 28; i >= 0; i -= 4) hex += digits[(h >> i) & 0xf];
+        return hex;
+    }
+
+private:
+    ////////////////////
+    std::uint32_t h_[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    unsigned char block_[64];
+    std::size_t used_ = 0;
+    std::uint64_t total_ = 0;
+
+    static std::uint32_t rotr(std::uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress()
+    {
+        static const std::uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+        };
+
+        std::uint32_t w[64];
+        for(auto i = 0; i < 16; ++i)
+            w[i] = std::uint32_t(block_[4 * i]) << 24 | std::uint32_t(block_[4 * i + 1]) << 16
+                 | std::uint32_t(block_[4 * i + 2]) << 8 | block_[4 * i + 3];
+        for(auto i = 16; i < 64; ++i)
+        {
+            auto s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            auto s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        auto a = h_[0], b = h_[1], c = h_[2], d = h_[3];
+        auto e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+        for(auto i = 0; i < 64; ++i)
+        {
+            auto t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            auto t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        h_[0] += a; h_[1] += b; h_[2] += c; h_[3] += d;
+        h_[4] += e; h_[5] += f; h_[6] += g; h_[7] += h;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// read whole file
+bool read_file(const std::string& path, std::string& data)
+{
+    auto fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1) return false;
+
+    auto done = drain(fd, data) == 0;
+    ::close(fd);
+    return done;
+}
+
+// write file atomically
+bool write_file(const std::string& path, const std::string& data)
+{
+    // unique to each call, as other threads may store the same key
+    auto temp = path + ".tmp.XXXXXX";
+
+    auto fd = ::mkostemp(&temp[0], O_CLOEXEC);
+    if(fd == -1) return false;
+    ::fchmod(fd, 0644);
+
+    std::size_t done = 0;
+    while(done < data.size())
+    {
+        auto n = ::write(fd, data.data() + done, data.size() - done);
+        if(n == -1 && errno == EINTR) continue;
+        if(n == -1) break;
+        done += n;
+    }
+    ::close(fd);
+
+    if(done == data.size() && !::rename(temp.data(), path.data())) return true;
+
+    ::unlink(temp.data());
+    return false;
+}
+
+// call fn(path, stat) for each stored result
+template<typename Fn>
+void for_each_file(const std::string& dir, Fn fn)
+{
+    std::unique_ptr<DIR, int(*)(DIR*)> top(::opendir(dir.data()), &::closedir);
+    if(!top) return;
+
+    while(auto e = ::readdir(top.get()))
+    {
+        if(e->d_name[0] == '.') continue;
+        auto sub = dir + "/" + e->d_name;
+
+        std::unique_ptr<DIR, int(*)(DIR*)> d(::opendir(sub.data()), &::closedir);
+        if(!d) continue;
+
+        while(auto f = ::readdir(d.get()))
+        {
+            if(f->d_name[0] == '.') continue;
+
+            // being written by another thread (see write_file)
+            if(std::strstr(f->d_name, ".tmp.")) continue;
+
+            auto path = sub + "/" + f->d_name;
+
+            struct stat st;
+            if(!::stat(path.data(), &st) && S_ISREG(st.st_mode)) fn(path, st);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// stored as: "pgm1 <code> <out size> <err size>\n" <out> <err>
+std::string serialize(const result_cache::result& r)
+{
+    auto data = "pgm1 " + std::to_string(r.status.code) + " "
+        + std::to_string(r.out.size()) + " " + std::to_string(r.err.size()) + "\n";
+    data += r.out;
+    data += r.err;
+    return data;
+}
+
+bool deserialize(const std::string& data, result_cache::result& r)
+{
+    int code, n;
+    unsigned long long out, err;
+    if(std::sscanf(data.data(), "pgm1 %d %llu %llu\n%n", &code, &out, &err, &n) != 3) return false;
+    if(n + out + err != data.size()) return false;
+
+    r.status = exit_status { exited, code, -1 };
+    r.out = data.substr(n, out);
+    r.err = data.substr(n + out, err);
+    return true;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+result_cache::result_cache(std::string dir, std::uint64_t disk, std::size_t memory) :
+    dir_(std::move(dir)), disk_max_(disk), memory_max_(memory)
+{
+    if(::mkdir(dir_.data(), 0755) && errno != EEXIST) throw posix::errno_error();
+
+    for_each_file(dir_, [&](const std::string&, const struct stat& st){ disk_ += st.st_size; });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::string result_cache::key(const job& j)
+{
+    sha256 hash;
+
+    hash.field(std::to_string(j.command.size()));
+    for(auto& arg : j.command) hash.field(arg);
+
+    hash.field(std::to_string(j.env.size()));
+    for(auto& name : j.env)
+    {
+        hash.field(name);
+
+        auto value = std::getenv(name.data());
+        hash.field(value ? std::string("=") + value : std::string());
+    }
+
+    hash.field(j.input);
+
+    hash.field(std::to_string(j.files.size()));
+    for(auto& path : j.files)
+    {
+        hash.field(path);
+
+        std::string data;
+        hash.field(read_file(path, data) ? "+" + data : std::string());
+    }
+
+    return hash.hex();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::string result_cache::path(const std::string& key) const
+{ return dir_ + "/" + key.substr(0, 2) + "/" + key.substr(2); }
+
+////////////////////////////////////////////////////////////////////////////////
+std::optional<result_cache::result> result_cache::find(const std::string& key)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if(it != index_.end())
+        {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            ++hits_;
+            ++memory_hits_;
+            return *it->second->second;
+        }
+    }
+
+    auto file = path(key);
+
+    std::string data;
+    auto r = std::make_shared<result>();
+    if(!read_file(file, data) || !deserialize(data, *r))
+    {
+        ++misses_;
+        return std::nullopt;
+    }
+
+    // mark as recently used for eviction
+    ::utimensat(AT_FDCWD, file.data(), nullptr, 0);
+
+    ++hits_;
+    remember(key, r);
+    return *r;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void result_cache::store(const std::string& key, const result& r)
+{
+    if(r.status.state != exited) return;
+
+    auto data = serialize(r);
+
+    auto file = path(key);
+    ::mkdir(file.substr(0, file.rfind('/')).data(), 0755);
+
+    // size of the result being replaced, if any
+    struct stat st;
+    std::uint64_t old = ::stat(file.data(), &st) ? 0 : st.st_size;
+
+    if(!write_file(file, data)) throw posix::errno_error();
+    ++stores_;
+
+    remember(key, std::make_shared<result>(r));
+
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        disk_ -= std::min(disk_, old);
+        disk_ += data.size();
+        full = disk_ > disk_max_;
+    }
+    if(full) evict();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void result_cache::remember(const std::string& key, std::shared_ptr<const result> r)
+{
+    auto size = r->out.size() + r->err.size() + key.size();
+    if(size > memory_max_) return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = index_.find(key);
+    if(it != index_.end())
+    {
+        memory_ -= it->second->second->out.size() + it->second->second->err.size() + key.size();
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+
+    lru_.emplace_front(key, std::move(r));
+    index_.emplace(key, lru_.begin());
+    memory_ += size;
+
+    while(memory_ > memory_max_)
+    {
+        auto& last = lru_.back();
+        memory_ -= last.second->out.size() + last.second->err.size() + last.first.size();
+        index_.erase(last.first);
+        lru_.pop_back();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void result_cache::evict()
+{
+    // rescan, as other processes may share the directory
+    std::vector<std::tuple<std::time_t, std::uint64_t, std::string>> files;
+    std::uint64_t total = 0;
+
+    for_each_file(dir_, [&](const std::string& path, const struct stat& st)
+    {
+        files.emplace_back(st.st_mtime, st.st_size, path);
+        total += st.st_size;
+    });
+    std::sort(files.begin(), files.end());
+
+    // leave some room, so that we don't evict on every store
+    auto target = disk_max_ - disk_max_ / 10;
+    for(auto& f : files)
+    {
+        if(total <= target) break;
+        if(!::unlink(std::get<2>(f).data()))
+        {
+            total -= std::get<1>(f);
+            ++evictions_;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    disk_ = total;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+result_cache::result result_cache::run(const job& j, const spawn_options& options)
+{
+    if(j.command.empty()) throw std::system_error(posix::errc::invalid_argument);
+
+    auto k = key(j);
+    if(auto r = find(k)) return std::move(*r);
+
+    process p(options, [&]{ return exec(j); });
+
+    result r;
+    collect(p, r.out, r.err);
+
+    p.join();
+    r.status = p.status();
+
+    // not being able to cache the result is not an error
+    try { store(k, r); } catch(std::system_error&) { }
+    return r;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+int result_cache::exec(const job& j)
+{
+    // feed stdin from memory
+    auto fd = ::memfd_create("stdin", 0);
+    if(fd == -1) return 127;
+
+    std::size_t done = 0;
+    while(done < j.input.size())
+    {
+        auto n = ::write(fd, j.input.data() + done, j.input.size() - done);
+        if(n == -1) { if(errno == EINTR) continue; return 127; }
+        done += n;
+    }
+    ::lseek(fd, 0, SEEK_SET);
+    ::dup2(fd, STDIN_FILENO);
+    ::close(fd);
+
+    auto args = make_charpp(j.command.begin(), j.command.end());
+    ::execvp(args[0], args.get());
+    return 127; // like the shell
+}
+
+////////////////////////////////////////////////////////////////////////////////
+result_cache::counters result_cache::stats() const noexcept
+{
+    counters c;
+    c.hits = hits_;
+    c.memory_hits = memory_hits_;
+    c.misses = misses_;
+    c.stores = stores_;
+    c.evictions = evictions_;
+    return c;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,122 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_RESULT_CACHE_HPP
+#define PGM_RESULT_CACHE_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/process.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Cache of results of deterministic commands.
+//
+// Commands are keyed by SHA-256 of their argv, values of selected
+// environment variables, stdin and contents of declared input files.
+// Exit code and output of commands which exited are stored on disk under
+// their key, with an in-memory LRU cache in front. Both are bounded
+// in size and evict least recently used results.
+//
+// Safe to use from multiple threads and processes sharing the directory.
+//
+class result_cache
+{
+public:
+    ////////////////////
+    struct job
+    {
+        std::vector<std::string> command; // run with execvp(3)
+        std::vector<std::string> env;     // names of variables it depends on
+        std::string input;                // stdin
+        std::vector<std::string> files;   // input files
+    };
+
+    struct result
+    {
+        exit_status status;
+        std::string out, err;
+    };
+
+    ////////////////////
+    // use directory (created if needed) with at most disk bytes of
+    // results and keep up to memory bytes of them in memory
+    explicit result_cache(std::string dir,
+        std::uint64_t disk = 1 << 30, std::size_t memory = 64 << 20);
+
+    result_cache(const result_cache&) = delete;
+    result_cache& operator=(const result_cache&) = delete;
+
+    ////////////////////
+    // get cached result of job or run it and cache the result
+    // (unless the job didn't exit normally)
+    result run(const job&, const spawn_options& = { });
+
+    // get key of job (hex string)
+    static std::string key(const job&);
+
+    // run job in the calling process (eg, child of pgm::process):
+    // feeds its input to stdin and replaces the process image
+    // returns 127 on failure
+    static int exec(const job&);
+
+    // look up or store result
+    std::optional<result> find(const std::string& key);
+    void store(const std::string& key, const result&);
+
+    ////////////////////
+    struct counters
+    {
+        std::uint64_t hits = 0;        // found in memory or on disk
+        std::uint64_t memory_hits = 0; // found in memory
+        std::uint64_t misses = 0;
+        std::uint64_t stores = 0;
+        std::uint64_t evictions = 0;   // removed from disk
+    };
+    counters stats() const noexcept;
+
+private:
+    ////////////////////
+    std::string dir_;
+    std::uint64_t disk_max_;
+    std::size_t memory_max_;
+
+    using entry = std::pair<std::string, std::shared_ptr<const result>>;
+
+    mutable std::mutex mutex_;
+    std::list<entry> lru_; // most recently used first
+    std::unordered_map<std::string, std::list<entry>::iterator> index_;
+    std::size_t memory_ = 0;
+    std::uint64_t disk_ = 0;
+
+    std::atomic<std::uint64_t> hits_ { 0 }, memory_hits_ { 0 }, misses_ { 0 };
+    std::atomic<std::uint64_t> stores_ { 0 }, evictions_ { 0 };
+
+    std::string path(const std::string& key) const;
+    void remember(const std::string& key, std::shared_ptr<const result>);
+    void evict();
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
@@ -0,0 +1,154 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "posix/error.hpp"
+#include "proc/sealed_data.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+sealed_data::sealed_data(std::string_view data, const char* name) :
+    sealed_data(data.size(), [&](char* p, std::size_t n){ std::memcpy(p, data.data(), n); }, name)
+{ }
+
+////////////////////////////////////////////////////////////////////////////////
+sealed_data::sealed_data(std::size_t size, const std::function<void(char*, std::size_t)>& fn,
+    const char* name)
+{
+    fd_ = ::memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(fd_ == -1) throw posix::errno_error();
+
+    try
+    {
+        if(::ftruncate(fd_, size)) throw posix::errno_error();
+        size_ = size;
+
+        if(size_)
+        {
+            // writable mapping has to be gone before F_SEAL_WRITE
+            auto data = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+            if(data == MAP_FAILED) throw posix::errno_error();
+            try { fn(static_cast<char*>(data), size_); }
+            catch(...) { ::munmap(data, size_); throw; }
+            ::munmap(data, size_);
+        }
+
+        if(::fcntl(fd_, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL))
+            throw posix::errno_error();
+
+        if(size_)
+        {
+            data_ = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+            if(data_ == MAP_FAILED) { data_ = nullptr; throw posix::errno_error(); }
+        }
+    }
+    catch(...)
+    {
+        reset();
+        throw;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+sealed_data sealed_data::from_file(const std::string& path)
+{
+    auto fd = ::open(path.data(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1) throw posix::errno_error();
+
+    struct stat st;
+    if(::fstat(fd, &st))
+    {
+        posix::errno_error error;
+        ::close(fd);
+        throw error;
+    }
+
+    try
+    {
+        sealed_data sd(st.st_size, [&](char* p, std::size_t n)
+        {
+            while(n)
+            {
+                auto c = ::read(fd, p, n);
+                if(c == -1 && errno == EINTR) continue;
+                if(c == -1) throw posix::errno_error();
+                if(c == 0) throw std::system_error(posix::errc::io_error); // truncated meanwhile
+
+                p += c;
+                n -= c;
+            }
+        }, path.data());
+
+        ::close(fd);
+        return sd;
+    }
+    catch(...)
+    {
+        ::close(fd);
+        throw;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+sealed_data::sealed_data(sealed_data&& rhs) noexcept :
+    fd_(std::exchange(rhs.fd_, -1)),
+    size_(std::exchange(rhs.size_, 0)),
+    data_(std::exchange(rhs.data_, nullptr))
+{ }
+
+sealed_data& sealed_data::operator=(sealed_data&& rhs) noexcept
+{
+    if(this != &rhs)
+    {
+        reset();
+        fd_ = std::exchange(rhs.fd_, -1);
+        size_ = std::exchange(rhs.size_, 0);
+        data_ = std::exchange(rhs.data_, nullptr);
+    }
+    return *this;
+}
+
+sealed_data::~sealed_data() { reset(); }
+
+////////////////////////////////////////////////////////////////////////////////
+void sealed_data::reset() noexcept
+{
+    if(data_) ::munmap(data_, size_);
+    if(fd_ != -1) ::close(fd_);
+
+    fd_ = -1;
+    size_ = 0;
+    data_ = nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::string sealed_data::path() const
+{
+    return "/proc/self/fd/" + std::to_string(fd_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void sealed_data::inherit() const noexcept
+{
+    if(fd_ != -1) ::fcntl(fd_, F_SETFD, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
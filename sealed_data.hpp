@@ -0,0 +1,80 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_SEALED_DATA_HPP
+#define PGM_SEALED_DATA_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Read-only data shared with children.
+//
+// Data is put into a memory file (memfd) once and sealed against writing,
+// shrinking and growing. Children started with it in their spawn_options
+// inherit the file at the same fd number as in the parent and can map it
+// (or open it through path()), so they all share the same pages instead
+// of each getting its own copy.
+//
+class sealed_data
+{
+public:
+    ////////////////////
+    // copy data
+    explicit sealed_data(std::string_view data, const char* name = "pgm-data");
+
+    // let fn fill size bytes of data in place
+    sealed_data(std::size_t size, const std::function<void(char*, std::size_t)>& fn,
+        const char* name = "pgm-data");
+
+    // read contents of file
+    static sealed_data from_file(const std::string& path);
+
+    sealed_data(sealed_data&&) noexcept;
+    sealed_data& operator=(sealed_data&&) noexcept;
+    ~sealed_data();
+
+    ////////////////////
+    // get file descriptor of memory file
+    int fd() const noexcept { return fd_; }
+
+    // get path of memory file (/proc/self/fd/N), which can be opened
+    // by this process or by children that inherited it
+    std::string path() const;
+
+    std::size_t size() const noexcept { return size_; }
+
+    // get data mapped into memory of this process
+    std::string_view view() const noexcept
+    { return std::string_view(static_cast<const char*>(data_), size_); }
+
+    ////////////////////
+    // let children of calling process inherit memory file
+    // at the same fd number; to be called in the child between fork and exec
+    void inherit() const noexcept;
+
+private:
+    ////////////////////
+    int fd_ = -1;
+    std::size_t size_ = 0;
+    void* data_ = nullptr;
+
+    void reset() noexcept;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
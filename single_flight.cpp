@@ -0,0 +1,286 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/drain.hpp"
+#include "proc/reactor.hpp"
+#include "proc/single_flight.hpp"
+
+#include <cerrno>
+#include <exception>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Running job shared by tickets and reactor callbacks.
+//
+struct single_flight::flight
+{
+    std::string key;
+
+    std::mutex mutex;
+    process proc;
+    result res;
+
+    int open = 0; // pipes not at EOF yet
+    bool exited = false;
+    bool done = false;
+    bool cancelled = false;
+    std::size_t waiters = 0;
+
+    std::promise<result> promise;
+    std::shared_future<result> future = promise.get_future().share();
+};
+
+////////////////////////////////////////////////////////////////////////////////
+single_flight::~single_flight()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    for(auto& each : flights_)
+    {
+        auto& f = *each.second;
+
+        std::lock_guard<std::mutex> flock(f.mutex);
+        if(f.proc.joinable()) try { f.proc.kill(); } catch(...) { }
+    }
+    idle_.wait(lock, [&]{ return !live_; });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+single_flight::ticket single_flight::launch(const job& j, const spawn_options& options)
+{
+    auto key = result_cache::key(j);
+
+    ticket t;
+    t.owner_ = this;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = flights_.find(key);
+        if(it != flights_.end())
+        {
+            auto& f = it->second;
+
+            std::lock_guard<std::mutex> flock(f->mutex);
+            if(!f->cancelled)
+            {
+                ++f->waiters;
+                ++attached_;
+
+                t.flight_ = f;
+                t.future_ = f->future;
+                return t;
+            }
+        }
+
+        // not running or being killed
+        auto f = std::make_shared<flight>();
+        f->key = std::move(key);
+        f->waiters = 1;
+
+        flights_[f->key] = f;
+        ++live_;
+
+        t.flight_ = f;
+        t.future_ = f->future;
+    }
+
+    auto& f = t.flight_;
+    if(cache_)
+    {
+        if(auto r = cache_->find(f->key))
+        {
+            ++cached_;
+            f->res = std::move(*r);
+            finish(f);
+            return t;
+        }
+    }
+
+    try { start(f, j, options); }
+    catch(std::exception& e)
+    {
+        bool started;
+        {
+            std::lock_guard<std::mutex> lock(f->mutex);
+            if((started = f->proc.joinable()))
+            {
+                // stop reading before getting rid of the process
+                auto& re = reactor::instance();
+                for(auto stream : { &f->proc.cout, &f->proc.cerr })
+                {
+                    auto fd = f->proc.fd(*stream);
+                    if(fd != -1) re.remove(fd);
+                }
+                f->proc.kill();
+            }
+        }
+        if(started)
+        {
+            // reading callback may still be waiting for the lock on the
+            // reactor thread, which may have to reap the process
+            try { f->proc.wait_exit(); } catch(std::system_error&) { }
+
+            std::lock_guard<std::mutex> lock(f->mutex);
+            if(f->proc.joinable()) f->proc.join();
+        }
+
+        f->res.err = e.what();
+        finish(f);
+    }
+    return t;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void single_flight::start(const std::shared_ptr<flight>& f, const job& j, const spawn_options& options)
+{
+    std::lock_guard<std::mutex> lock(f->mutex);
+
+    f->proc = process(options, [&]{ return result_cache::exec(j); });
+    ++launched_;
+
+    auto& re = reactor::instance();
+    for(auto stream : { &f->proc.cout, &f->proc.cerr })
+    {
+        auto fd = f->proc.fd(*stream);
+        if(fd == -1) continue; // redirected to file
+
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        auto to = stream == &f->proc.cout ? &result::out : &result::err;
+        re.add(fd, EPOLLIN, [this, f, fd, to](std::uint32_t)
+        {
+            bool complete = false;
+            {
+                std::lock_guard<std::mutex> lock(f->mutex);
+                if(drain(fd, f->res.*to) == -1 && errno == EAGAIN) return;
+
+                // EOF or error
+                reactor::instance().remove(fd);
+                complete = !--f->open && f->exited;
+            }
+            if(complete) finish(f);
+        });
+        ++f->open;
+    }
+
+    f->proc.then([this, f](const exit_status& status)
+    {
+        bool complete;
+        {
+            std::lock_guard<std::mutex> lock(f->mutex);
+            f->res.status = status;
+            f->exited = true;
+
+            // already reaped, so this doesn't block
+            f->proc.join();
+
+            complete = !f->open;
+        }
+        if(complete) finish(f);
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void single_flight::finish(const std::shared_ptr<flight>& f)
+{
+    result res;
+    bool store;
+    {
+        std::lock_guard<std::mutex> lock(f->mutex);
+        if(f->done) return;
+
+        f->done = true;
+        res = f->res;
+        store = f->exited && !f->cancelled && res.status.state == exited;
+    }
+
+    if(cache_ && store)
+        try { cache_->store(f->key, res); } catch(std::system_error&) { }
+
+    f->promise.set_value(std::move(res));
+    forget(f);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(!--live_) idle_.notify_all();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void single_flight::forget(const std::shared_ptr<flight>& f)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = flights_.find(f->key);
+    if(it != flights_.end() && it->second == f) flights_.erase(it);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t single_flight::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return live_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+single_flight::counters single_flight::stats() const noexcept
+{
+    counters c;
+    c.launched = launched_;
+    c.attached = attached_;
+    c.cached = cached_;
+    c.cancelled = cancelled_;
+    return c;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+single_flight::ticket& single_flight::ticket::operator=(ticket&& rhs) noexcept
+{
+    cancel();
+
+    owner_ = rhs.owner_;
+    flight_ = std::move(rhs.flight_);
+    future_ = std::move(rhs.future_);
+    return *this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void single_flight::ticket::cancel() noexcept
+{
+    if(!flight_) return;
+
+    bool killed = false;
+    {
+        std::lock_guard<std::mutex> lock(flight_->mutex);
+        if(!--flight_->waiters && !flight_->done)
+        {
+            flight_->cancelled = true;
+            if(flight_->proc.joinable()) try { flight_->proc.kill(); } catch(...) { }
+            killed = true;
+        }
+    }
+
+    // let new callers start over
+    if(killed)
+    {
+        ++owner_->cancelled_;
+        owner_->forget(flight_);
+    }
+
+    flight_.reset();
+    future_ = { };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
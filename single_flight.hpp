@@ -0,0 +1,128 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_SINGLE_FLIGHT_HPP
+#define PGM_SINGLE_FLIGHT_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/result_cache.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Deduplicates identical jobs running at the same time.
+//
+// Jobs are keyed the same way as in result_cache. If an identical job
+// is already running, the caller gets a ticket for it instead of
+// starting a new one. Output is collected on the reactor thread.
+//
+// Every ticket holds a reference to the job. When all tickets for a job
+// which is still running are cancelled or destroyed, it's killed.
+//
+// Optionally, results are looked up in and stored to a result_cache.
+//
+class single_flight
+{
+public:
+    ////////////////////
+    using job = result_cache::job;
+    using result = result_cache::result;
+
+    // use cache, if given, which must outlive this object
+    explicit single_flight(result_cache* cache = nullptr) : cache_(cache) { }
+
+    // kill running jobs and wait for them to finish
+    ~single_flight();
+
+    single_flight(const single_flight&) = delete;
+    single_flight& operator=(const single_flight&) = delete;
+
+    ////////////////////
+    struct flight;
+
+    class ticket
+    {
+    public:
+        ////////////////////
+        ticket() noexcept = default;
+        ticket(ticket&&) noexcept = default;
+        ticket& operator=(ticket&& rhs) noexcept;
+        ~ticket() { cancel(); }
+
+        bool valid() const noexcept { return flight_ != nullptr; }
+
+        ////////////////////
+        // wait for and get result
+        const result& get() const { return future_.get(); }
+
+        template<typename Rep, typename Period>
+        bool wait_for(const std::chrono::duration<Rep, Period>& time) const
+        { return future_.wait_for(time) == std::future_status::ready; }
+
+        // stop waiting; kills the job if nobody else is waiting for it
+        void cancel() noexcept;
+
+    private:
+        ////////////////////
+        single_flight* owner_ = nullptr;
+        std::shared_ptr<flight> flight_;
+        std::shared_future<result> future_;
+
+        friend class single_flight;
+    };
+
+    // start job or attach to an identical one already running
+    ticket launch(const job&, const spawn_options& = { });
+
+    // get number of jobs running
+    std::size_t size() const;
+
+    ////////////////////
+    struct counters
+    {
+        std::uint64_t launched = 0;  // jobs started
+        std::uint64_t attached = 0;  // callers attached to running jobs
+        std::uint64_t cached = 0;    // results found in cache
+        std::uint64_t cancelled = 0; // jobs killed as nobody waited for them
+    };
+    counters stats() const noexcept;
+
+private:
+    ////////////////////
+    result_cache* cache_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<flight>> flights_;
+
+    std::size_t live_ = 0; // including cancelled ones still running
+    std::condition_variable idle_;
+
+    std::atomic<std::uint64_t> launched_ { 0 }, attached_ { 0 }, cached_ { 0 }, cancelled_ { 0 };
+
+    void start(const std::shared_ptr<flight>&, const job&, const spawn_options&);
+    void finish(const std::shared_ptr<flight>&);
+    void forget(const std::shared_ptr<flight>&);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
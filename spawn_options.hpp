@@ -0,0 +1,155 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_SPAWN_OPTIONS_HPP
+#define PGM_SPAWN_OPTIONS_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+class group;
+class jobserver;
+class placement;
+class sealed_data;
+
+////////////////////////////////////////////////////////////////////////////////
+// Options applied when starting a process.
+//
+struct spawn_options
+{
+    ////////////////////
+    // open stdout and/or stderr pipe in packet mode (O_DIRECT),
+    // where each write by the process becomes a separate record
+    bool packet_out = false;
+    bool packet_err = false;
+
+    ////////////////////
+    // file to connect process' stdin, stdout or stderr to instead of pipe
+    //
+    // The file is opened by the parent (with O_CLOEXEC) and becomes
+    // the stream of the process, so its output doesn't pass through
+    // the parent. The corresponding cin, cout or cerr is not available.
+    struct file
+    {
+        std::string path;    // empty = use pipe
+        bool append = false; // append rather than truncate (stdout and stderr)
+    };
+    file in, out, err;
+
+    // capture stdout in memory file (memfd) instead of pipe; the output
+    // isn't read while the process runs and can be accessed without
+    // copying once it's been joined (see process::output())
+    bool capture_out = false;
+
+    ////////////////////
+    // other file descriptors to pass on to process: { parent fd, child fd },
+    // eg, { { sock, 3 }, { log, 4 } }; child fds must be above stderr and
+    // unique, but can overlap with parent fds in any way
+    //
+    // Parent fds are taken before stdio of the process is set up, so eg,
+    // { 1, 3 } passes our stdout. If given, all other fds of the process
+    // (except its stdin, stdout, stderr, and those of jobserver and data
+    // below) are closed before it runs.
+    std::vector<std::pair<int, int>> fds;
+
+    ////////////////////
+    // terminate process if it's still running after timeout (0 = none);
+    // send SIGTERM first and then SIGKILL if it's still running after grace
+    std::chrono::milliseconds timeout { 0 };
+    std::chrono::milliseconds grace { 5000 };
+
+    ////////////////////
+    // process group to put process into:
+    // -1 = parent's, 0 = new one, or id of existing group
+    pid_t pgid = -1;
+
+    // cgroup v2 directory to put process into (created if needed)
+    std::string cgroup;
+
+    // group to add process to (overrides pgid and cgroup above);
+    // must outlive the process constructor
+    pgm::group* group = nullptr;
+
+    ////////////////////
+    // create a new cgroup for process under this directory (overrides
+    // cgroup above) and apply limits below to it (0 = no limit)
+    //
+    // If the cgroup hierarchy is not delegated to us, the process is
+    // started without a cgroup. Limits that cannot be set are skipped.
+    std::string cgroup_parent;
+
+    std::chrono::microseconds cpu_quota { 0 }; // cpu.max
+    std::chrono::microseconds cpu_period { 100000 };
+    std::uint64_t memory_max = 0; // memory.max, bytes
+    std::uint64_t pids_max = 0;   // pids.max
+
+    ////////////////////
+    // CPUs to run process on (empty = inherit)
+    std::vector<int> cpus;
+
+    // NUMA memory policy for nodes (see set_mempolicy(2))
+    enum numa_policy { numa_default, numa_bind, numa_preferred, numa_interleave };
+    numa_policy numa = numa_default;
+    std::vector<int> nodes;
+
+    // placement policy to get CPUs and NUMA node from (overrides the above);
+    // must outlive the process
+    pgm::placement* placement = nullptr;
+
+    ////////////////////
+    // nice value of process (empty = inherit)
+    std::optional<int> nice;
+
+    // scheduling policy of process (see sched(7))
+    enum sched_policy { sched_inherit, sched_other, sched_batch, sched_idle };
+    sched_policy sched = sched_inherit;
+
+    // I/O scheduling class and priority level (0-7, lower is higher)
+    // of process (see ioprio_set(2))
+    enum io_class { io_inherit, io_realtime, io_best_effort, io_idle };
+    io_class io = io_inherit;
+    int io_level = 4;
+
+    ////////////////////
+    // resource limits of process (see setrlimit(2)), eg:
+    // { { RLIMIT_CPU, 10, 15 }, { RLIMIT_AS, 1 << 30, 1 << 30 } }
+    struct limit
+    {
+        int resource;
+        rlim_t soft, hard;
+    };
+    std::vector<limit> limits;
+
+    ////////////////////
+    // jobserver to get token from before starting process (blocks until
+    // one is available) and to pass on to it; the token is given back
+    // when the process finishes; must outlive the process
+    pgm::jobserver* jobserver = nullptr;
+
+    ////////////////////
+    // sealed data to pass on to process at the same fd numbers
+    // (see sealed_data::fd() and path()); must outlive the process constructor
+    std::vector<const pgm::sealed_data*> data;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
@@ -0,0 +1,122 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/split.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define PGM_SPLIT_X86
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+using split_fn = std::function<void(std::string_view)>;
+
+// emit records ending at each bit set in mask,
+// where bit 0 corresponds to p[0]
+template<typename Mask>
+inline const char* emit(const char* line, const char* p, Mask mask, const split_fn& fn)
+{
+    while(mask)
+    {
+        auto end = p + __builtin_ctzll(mask);
+        fn(std::string_view(line, end - line));
+        line = end + 1;
+        mask &= mask - 1;
+    }
+    return line;
+}
+
+// scalar tail (or the whole thing if no SIMD)
+const char* split_scalar(const char* line, const char* p, const char* last, char delim, const split_fn& fn)
+{
+    while(p < last)
+    {
+        auto end = static_cast<const char*>(std::memchr(p, delim, last - p));
+        if(!end) break;
+
+        fn(std::string_view(line, end - line));
+        line = p = end + 1;
+    }
+    return line;
+}
+
+#ifdef PGM_SPLIT_X86
+////////////////////////////////////////////////////////////////////////////////
+__attribute__((target("sse2")))
+const char* split_sse2(const char* first, const char* last, char delim, const split_fn& fn)
+{
+    auto line = first, p = first;
+    auto d = _mm_set1_epi8(delim);
+
+    for(; last - p >= 16; p += 16)
+    {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, d)));
+        if(mask) line = emit(line, p, mask, fn);
+    }
+    return split_scalar(line, p, last, delim, fn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+__attribute__((target("avx2")))
+const char* split_avx2(const char* first, const char* last, char delim, const split_fn& fn)
+{
+    auto line = first, p = first;
+    auto d = _mm256_set1_epi8(delim);
+
+    // two vectors per iteration to amortize the branch
+    for(; last - p >= 64; p += 64)
+    {
+        auto v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        auto v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+        auto lo = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, d)));
+        auto hi = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, d)));
+
+        auto mask = (std::uint64_t(hi) << 32) | lo;
+        if(mask) line = emit(line, p, mask, fn);
+    }
+    return split_scalar(line, p, last, delim, fn);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+const char* split_generic(const char* first, const char* last, char delim, const split_fn& fn)
+{ return split_scalar(first, first, last, delim, fn); }
+
+using split_impl = const char*(*)(const char*, const char*, char, const split_fn&);
+
+split_impl select() noexcept
+{
+#ifdef PGM_SPLIT_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return &split_avx2;
+    if(__builtin_cpu_supports("sse2")) return &split_sse2;
+#endif
+    return &split_generic;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+const char* split(const char* first, const char* last, char delim, const split_fn& fn)
+{
+    static const auto impl = select();
+    return impl(first, last, delim, fn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,35 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_SPLIT_HPP
+#define PGM_SPLIT_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include <functional>
+#include <string_view>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Split [first, last) on delim and call fn for each complete record
+// (without the delimiter).
+//
+// Returns pointer past the last delimiter found, ie, the beginning
+// of a partial record (or last, if there is none).
+//
+// Uses AVX2 or SSE2 when available and falls back to scalar code.
+//
+const char* split(const char* first, const char* last, char delim,
+    const std::function<void(std::string_view)>& fn);
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
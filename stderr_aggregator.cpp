@@ -0,0 +1,449 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "posix/error.hpp"
+#include "proc/reactor.hpp"
+#include "proc/stderr_aggregator.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <future>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+namespace
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Bounded lock-free queue for multiple producers and one consumer.
+//
+// Each cell has a sequence number, which tells producers and the consumer
+// whether it's free or full for the current lap around the ring
+// (see Dmitry Vyukov's bounded MPMC queue).
+//
+template<typename T>
+class mpsc_queue
+{
+public:
+    ////////////////////
+    explicit mpsc_queue(std::size_t capacity)
+    {
+        std::size_t size = 2;
+        while(size < capacity) size <<= 1;
+
+        cells_.reset(new cell[size]);
+        size_ = size;
+        mask_ = size - 1;
+        for(std::size_t i = 0; i < size; ++i) cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    std::size_t capacity() const noexcept { return size_; }
+
+    // returns false if the queue is full
+    bool push(T& value)
+    {
+        auto pos = head_.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            auto& c = cells_[pos & mask_];
+            auto seq = c.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+
+            if(diff == 0)
+            {
+                if(head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    c.value = std::move(value);
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(diff < 0) return false; // consumer is a lap behind
+            else pos = head_.load(std::memory_order_relaxed);
+        }
+    }
+
+    // returns false if the queue is empty
+    // (to be called by the consumer only)
+    bool pop(T& value)
+    {
+        auto pos = tail_.load(std::memory_order_relaxed);
+        auto& c = cells_[pos & mask_];
+
+        if(c.seq.load(std::memory_order_acquire) != pos + 1) return false;
+
+        value = std::move(c.value);
+        c.seq.store(pos + mask_ + 1, std::memory_order_release);
+        tail_.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    ////////////////////
+    struct cell
+    {
+        std::atomic<std::size_t> seq;
+        T value;
+    };
+    std::unique_ptr<cell[]> cells_;
+    std::size_t size_, mask_;
+
+    // on separate cache lines
+    alignas(64) std::atomic<std::size_t> head_ { 0 }; // next to push
+    alignas(64) std::atomic<std::size_t> tail_ { 0 }; // next to pop
+};
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Stderr pipe being read (only touched on the reactor thread).
+//
+struct stderr_aggregator::stream
+{
+    int fd = -1; // dup of the process's stderr, which we own
+    pid_t pid;
+    std::string buffer; // not yet pushed
+    bool eof = false;
+
+    ~stream() { if(fd != -1) ::close(fd); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// State shared with the reactor and the consumer thread.
+//
+struct stderr_aggregator::state : std::enable_shared_from_this<stderr_aggregator::state>
+{
+    ////////////////////
+    sink out;
+    std::size_t max_line;
+    mpsc_queue<line> queue;
+
+    // streams being read and those waiting for room in the queue
+    // (only touched on the reactor thread)
+    std::unordered_map<stream*, std::shared_ptr<stream>> streams;
+    std::vector<std::shared_ptr<stream>> stalled;
+    bool closed = false;
+
+    ////////////////////
+    std::thread consumer;
+    int wake = -1; // eventfd to wake up consumer
+    int room = -1; // eventfd to wake up reactor once there is room in queue
+    std::atomic<bool> sleeping { false }, full { false }, stopping { false };
+
+    std::atomic<std::uint64_t> lines { 0 }, stalls { 0 };
+
+    ////////////////////
+    state(sink s, std::size_t capacity, std::size_t max) :
+        out(std::move(s)), max_line(max), queue(capacity)
+    { }
+    ~state()
+    {
+        if(wake != -1) ::close(wake);
+        if(room != -1) ::close(room);
+    }
+
+    void watch(const std::shared_ptr<stream>&);
+    void read(const std::shared_ptr<stream>&);
+    void resume();
+    void finish(const std::shared_ptr<stream>&);
+
+    bool push(const std::shared_ptr<stream>&);
+    bool flush(stream&);
+    void consume();
+};
+
+////////////////////////////////////////////////////////////////////////////////
+void stderr_aggregator::state::watch(const std::shared_ptr<stream>& s)
+{
+    auto self = shared_from_this();
+    reactor::instance().add(s->fd, EPOLLIN, [self, s](std::uint32_t){ self->read(s); });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void stderr_aggregator::state::read(const std::shared_ptr<stream>& s)
+{
+    char buffer[64 * 1024];
+    auto n = ::read(s->fd, buffer, sizeof(buffer));
+
+    if(n > 0) s->buffer.append(buffer, n);
+    else if(n == 0 || (errno != EAGAIN && errno != EINTR)) s->eof = true;
+    else return;
+
+    if(!push(s))
+    {
+        ++stalls;
+        reactor::instance().remove(s->fd);
+    }
+    else if(s->eof) finish(s);
+}
+
+// called by the reactor, once the consumer has made room in the queue
+void stderr_aggregator::state::resume()
+{
+    std::uint64_t value;
+    ::read(room, &value, sizeof(value));
+
+    auto waiting = std::move(stalled);
+    stalled.clear();
+
+    for(auto& s : waiting)
+    {
+        if(closed) break;
+
+        if(!push(s)) continue;
+        else if(s->eof) finish(s);
+        else watch(s);
+    }
+}
+
+void stderr_aggregator::state::finish(const std::shared_ptr<stream>& s)
+{
+    reactor::instance().remove(s->fd);
+    ::close(s->fd);
+    s->fd = -1;
+
+    streams.erase(s.get());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// push lines of stream to the queue; if it's full, put stream on the
+// stalled list until the consumer makes room and return false
+bool stderr_aggregator::state::push(const std::shared_ptr<stream>& s)
+{
+    if(flush(*s)) return true;
+
+    // tell consumer to wake us up and try once more;
+    // pairs with the fence in consume()
+    full.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if(flush(*s)) return true;
+
+    stalled.push_back(s);
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool stderr_aggregator::state::flush(stream& s)
+{
+    std::size_t pos = 0;
+    bool done = true;
+    for(;;)
+    {
+        auto left = s.buffer.size() - pos;
+        auto nl = s.buffer.find('\n', pos);
+
+        std::size_t size, skip = 0;
+        if(nl != std::string::npos && nl - pos <= max_line) size = nl - pos, skip = 1;
+        else if(left >= max_line) size = max_line; // split long line
+        else if(s.eof && left) size = left; // unterminated last line
+        else break;
+
+        line l { s.pid, std::chrono::system_clock::now(), s.buffer.substr(pos, size) };
+        if(!queue.push(l)) { done = false; break; }
+
+        pos += size + skip;
+    }
+    s.buffer.erase(0, pos);
+
+    // pairs with the fence in consume()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(pos && sleeping.load(std::memory_order_relaxed) && sleeping.exchange(false))
+    {
+        std::uint64_t one = 1;
+        ::write(wake, &one, sizeof(one));
+    }
+    return done;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void stderr_aggregator::state::consume()
+{
+    // wake up reactor, if it's waiting for room in the queue
+    std::size_t popped = 0;
+    auto make_room = [&]
+    {
+        popped = 0;
+
+        // pairs with the fence in push()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(full.load(std::memory_order_relaxed) && full.exchange(false))
+        {
+            std::uint64_t one = 1;
+            ::write(room, &one, sizeof(one));
+        }
+    };
+
+    // not after every line, so that the reactor can refill
+    // the queue in batches instead of one line at a time
+    auto pass = [&](const line& l)
+    {
+        if(++popped >= queue.capacity() / 2) make_room();
+
+        try { out(l); } catch(...) { }
+        lines.fetch_add(1, std::memory_order_relaxed);
+    };
+
+    line l;
+    for(;;)
+    {
+        while(queue.pop(l)) pass(l);
+        make_room();
+
+        // tell producers to wake us up and check once more
+        sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if(queue.pop(l))
+        {
+            sleeping.store(false);
+            pass(l);
+            continue;
+        }
+        if(stopping) break;
+
+        std::uint64_t value;
+        while(::read(wake, &value, sizeof(value)) == -1 && errno == EINTR);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+stderr_aggregator::stderr_aggregator(sink s, std::size_t capacity, std::size_t max_line)
+{
+    if(!s || !max_line) throw std::system_error(posix::errc::invalid_argument);
+
+    state_ = std::make_shared<state>(std::move(s), capacity, max_line);
+
+    state_->wake = ::eventfd(0, EFD_CLOEXEC);
+    if(state_->wake == -1) throw posix::errno_error();
+
+    state_->room = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(state_->room == -1) throw posix::errno_error();
+
+    reactor::instance().add(state_->room, EPOLLIN, [st = state_](std::uint32_t){ st->resume(); });
+
+    state_->consumer = std::thread(&state::consume, state_.get());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+stderr_aggregator::~stderr_aggregator()
+{
+    auto& re = reactor::instance();
+
+    // stop reading on the reactor thread, so nothing is added back
+    auto close = [st = state_]
+    {
+        st->closed = true;
+        reactor::instance().remove(st->room);
+
+        for(auto& each : st->streams)
+        {
+            auto& s = *each.second;
+            reactor::instance().remove(s.fd);
+            ::close(s.fd);
+            s.fd = -1;
+        }
+        st->streams.clear();
+        st->stalled.clear();
+    };
+    if(re.this_thread()) close();
+    else
+    {
+        std::promise<void> done;
+        re.post([&]{ close(); done.set_value(); });
+        done.get_future().wait();
+    }
+
+    state_->stopping = true;
+
+    std::uint64_t one = 1;
+    ::write(state_->wake, &one, sizeof(one));
+
+    state_->consumer.join();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void stderr_aggregator::add(process& p)
+{
+    auto fd = p.fd(p.cerr);
+    if(fd == -1) throw std::system_error(posix::errc::invalid_argument);
+
+    // own a copy, so that it stays open even if the process is gone
+    auto s = std::make_shared<stream>();
+    s->fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if(s->fd == -1) throw posix::errno_error();
+
+    if(::fcntl(s->fd, F_SETFL, ::fcntl(s->fd, F_GETFL) | O_NONBLOCK)) throw posix::errno_error();
+    s->pid = p.native_handle();
+
+    reactor::instance().post([st = state_, s]
+    {
+        if(st->closed) return;
+
+        st->streams.emplace(s.get(), s);
+        st->watch(s);
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+stderr_aggregator::counters stderr_aggregator::stats() const noexcept
+{
+    counters c;
+    c.lines = state_->lines.load(std::memory_order_relaxed);
+    c.stalls = state_->stalls.load(std::memory_order_relaxed);
+    return c;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+stderr_aggregator::sink stderr_aggregator::to_fd(int fd)
+{
+    return [fd](const line& l)
+    {
+        using namespace std::chrono;
+        auto time = system_clock::to_time_t(l.time);
+        auto usec = duration_cast<microseconds>(l.time.time_since_epoch()).count() % 1000000;
+
+        std::tm tm;
+        ::gmtime_r(&time, &tm);
+
+        char head[64];
+        auto n = std::strftime(head, sizeof(head), "%Y-%m-%dT%H:%M:%S", &tm);
+        n += std::snprintf(head + n, sizeof(head) - n, ".%06dZ [%d] ", static_cast<int>(usec), static_cast<int>(l.pid));
+
+        // one write per line, so that it's not interleaved with others
+        std::string text;
+        text.reserve(n + l.text.size() + 1);
+        text.append(head, n).append(l.text).append(1, '\n');
+
+        for(auto p = text.data(), e = p + text.size(); p < e; )
+        {
+            auto c = ::write(fd, p, e - p);
+            if(c == -1 && errno == EINTR) continue;
+            if(c == -1) throw posix::errno_error();
+            p += c;
+        }
+    };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
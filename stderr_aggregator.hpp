@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_STDERR_AGGREGATOR_HPP
+#define PGM_STDERR_AGGREGATOR_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/process.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <sys/types.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Collects stderr of many processes into one sink, line by line.
+//
+// Stderr pipes are read on the reactor thread, which cuts them into
+// complete lines, tags them with pid and time and pushes them to a bounded
+// lock-free queue. A single consumer thread pops them and passes them to
+// the sink, so lines of different processes never interleave and the sink
+// doesn't need to be thread-safe.
+//
+// When the queue is full, reading stops until there is room again, so
+// lines are never dropped and processes block on writes instead.
+//
+class stderr_aggregator
+{
+public:
+    ////////////////////
+    struct line
+    {
+        pid_t pid;
+        std::chrono::system_clock::time_point time;
+        std::string text; // without '\n'
+    };
+    using sink = std::function<void(const line&)>;
+
+    // create sink writing lines to fd as "<UTC time> [<pid>] <text>\n"
+    static sink to_fd(int fd);
+
+    ////////////////////
+    // pass lines to sink; queue holds up to capacity lines
+    // (rounded up to power of 2); longer lines are split
+    explicit stderr_aggregator(sink, std::size_t capacity = 4096, std::size_t max_line = 64 * 1024);
+
+    // pass remaining lines to sink and stop;
+    // lines still in the pipes are not collected
+    ~stderr_aggregator();
+
+    stderr_aggregator(const stderr_aggregator&) = delete;
+    stderr_aggregator& operator=(const stderr_aggregator&) = delete;
+
+    ////////////////////
+    // collect stderr of process until it's closed (reads from a copy
+    // of the pipe, so process may go away before that);
+    // process::cerr should not be used afterwards
+    void add(process&);
+
+    ////////////////////
+    struct counters
+    {
+        std::uint64_t lines = 0;  // passed to sink
+        std::uint64_t stalls = 0; // times reading stopped due to full queue
+    };
+    counters stats() const noexcept;
+
+private:
+    ////////////////////
+    struct state;
+    struct stream;
+    std::shared_ptr<state> state_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif
@@ -0,0 +1,55 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/job_runner.hpp"
+#include "proc/jobserver.hpp"
+
+#include <cstdlib>
+#include <iostream>
+
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Regression checks for job_runner.
+//
+// Build and run with the library sources, eg:
+//   g++ -std=c++17 -I<dir containing proc> test/job_runner.cpp *.cpp -pthread
+//
+int main()
+{
+    // fail instead of hanging
+    ::alarm(30);
+
+    ////////////////////
+    // with only the implicit token, jobs run one after another, and each
+    // has to be started when the previous one gives the token back
+    {
+        pgm::jobserver js(1);
+
+        pgm::spawn_options options;
+        options.jobserver = &js;
+
+        pgm::job_runner runner(4, options);
+        for(int i = 0; i < 3; ++i) runner.add({ "true" });
+
+        auto results = runner.wait();
+        if(results.size() != 3)
+        {
+            std::cerr << "jobserver(1): " << results.size() << " of 3 jobs finished" << std::endl;
+            return EXIT_FAILURE;
+        }
+        for(auto& r : results)
+            if(r.status.state != pgm::exited || r.status.code != 0)
+            {
+                std::cerr << "jobserver(1): job " << r.id << " failed" << std::endl;
+                return EXIT_FAILURE;
+            }
+    }
+
+    std::cerr << "ok" << std::endl;
+    return EXIT_SUCCESS;
+}
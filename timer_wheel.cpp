@@ -0,0 +1,119 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "proc/timer_wheel.hpp"
+
+#include <algorithm>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+void timer_wheel::add(clock::time_point tp, callback fn)
+{
+    // round up, so timers never fire early;
+    // current tick has already been processed
+    auto tick = to_tick(tp + std::chrono::milliseconds(1) - clock::duration(1));
+    insert(entry { std::max(tick, now_ + 1), std::move(fn) });
+    ++size_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void timer_wheel::advance(clock::time_point now, std::vector<callback>& out)
+{
+    auto tick = to_tick(now);
+    while(now_ < tick)
+    {
+        if(!size_) { now_ = tick; break; }
+
+        // if lower levels are empty, nothing can happen
+        // until the next level comes around
+        unsigned level = 0;
+        while(level < levels - 1 && !count_[level]) ++level;
+        if(level)
+        {
+            auto span = std::uint64_t(1) << (bits * level);
+            auto next = (now_ | (span - 1)) + 1;
+            if(next > tick) { now_ = tick; break; }
+            now_ = next - 1;
+        }
+
+        ++now_;
+        for(level = levels - 1; level; --level)
+            if(!(now_ & ((std::uint64_t(1) << (bits * level)) - 1))) cascade(level);
+
+        auto& s = wheel_[0][now_ & mask];
+        count_[0] -= s.size();
+        size_ -= s.size();
+
+        for(auto& e : s) out.push_back(std::move(e.fn));
+        s.clear();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+timer_wheel::clock::time_point timer_wheel::next() const noexcept
+{
+    if(!size_) return clock::time_point::max();
+
+    if(count_[0])
+    {
+        // level 0 only has entries within the current revolution
+        for(auto tick = now_ + 1; ; ++tick)
+            if(wheel_[0][tick & mask].size()) return to_time(tick);
+    }
+
+    unsigned level = 1;
+    while(level < levels - 1 && !count_[level]) ++level;
+
+    auto span = std::uint64_t(1) << (bits * level);
+    return to_time((now_ | (span - 1)) + 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::uint64_t timer_wheel::to_tick(clock::time_point tp) const noexcept
+{
+    if(tp <= epoch_) return 0;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(tp - epoch_).count();
+}
+
+timer_wheel::clock::time_point timer_wheel::to_time(std::uint64_t tick) const noexcept
+{ return epoch_ + std::chrono::milliseconds(tick); }
+
+////////////////////////////////////////////////////////////////////////////////
+void timer_wheel::insert(entry&& e)
+{
+    // the highest differing byte between tick and now_
+    // determines the level
+    auto diff = e.tick ^ now_;
+    unsigned level = 0;
+    while(level < levels - 1 && (diff >> (bits * (level + 1)))) ++level;
+
+    std::size_t index;
+    if(diff >> (bits * levels))
+        // too far out: park it in the last slot before wrap-around
+        index = ((now_ >> (bits * level)) + mask) & mask;
+    else index = (e.tick >> (bits * level)) & mask;
+
+    wheel_[level][index].push_back(std::move(e));
+    ++count_[level];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void timer_wheel::cascade(unsigned level)
+{
+    auto& s = wheel_[level][(now_ >> (bits * level)) & mask];
+    count_[level] -= s.size();
+
+    slot entries;
+    entries.swap(s);
+    for(auto& e : entries) insert(std::move(e));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,92 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2013-2017 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#ifndef PGM_TIMER_WHEEL_HPP
+#define PGM_TIMER_WHEEL_HPP
+
+////////////////////////////////////////////////////////////////////////////////
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pgm
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Hierarchical timer wheel.
+//
+// Has 4 levels of 256 slots each with 1 ms resolution, which covers
+// about 49 days. Timers further out are parked in the top level
+// and re-inserted when it comes around.
+//
+// Adding a timer is O(1). Expired timers are collected by advance().
+// Timers cannot be cancelled: callbacks should check whether they
+// are still relevant.
+//
+// Not thread-safe.
+//
+class timer_wheel
+{
+public:
+    ////////////////////
+    using clock = std::chrono::steady_clock;
+    using callback = std::function<void()>;
+
+    timer_wheel() : epoch_(clock::now()) { }
+
+    ////////////////////
+    // add timer expiring at tp
+    void add(clock::time_point tp, callback);
+
+    // advance wheel to now and move expired callbacks to out
+    void advance(clock::time_point now, std::vector<callback>& out);
+
+    // earliest time when advance() may have something to do
+    // or clock::time_point::max() if the wheel is empty
+    clock::time_point next() const noexcept;
+
+    bool empty() const noexcept { return size_ == 0; }
+    auto size() const noexcept { return size_; }
+
+private:
+    ////////////////////
+    static constexpr unsigned levels = 4;
+    static constexpr unsigned bits = 8;
+    static constexpr unsigned slots = 1 << bits;
+    static constexpr unsigned mask = slots - 1;
+
+    struct entry
+    {
+        std::uint64_t tick;
+        callback fn;
+    };
+    using slot = std::vector<entry>;
+
+    std::array<std::array<slot, slots>, levels> wheel_;
+    std::array<std::size_t, levels> count_ { };
+    std::size_t size_ = 0;
+
+    clock::time_point epoch_;
+    std::uint64_t now_ = 0; // current tick
+
+    ////////////////////
+    std::uint64_t to_tick(clock::time_point) const noexcept;
+    clock::time_point to_time(std::uint64_t) const noexcept;
+
+    void insert(entry&&);
+    void cascade(unsigned level);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+#endif